@@ -5,7 +5,16 @@
 
 import java.io.FileWriter;
 import java.io.IOException;
+import java.nio.DoubleBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
 import java.util.*;
+import java.util.concurrent.atomic.DoubleAdder;
+import java.util.concurrent.atomic.LongAdder;
+import java.util.stream.IntStream;
+import java.util.stream.Stream;
 
 /**
  * @brief Utility class providing helper methods
@@ -27,13 +36,397 @@ class Utils {
         }
         System.out.println();
     }
+
+    /**
+     * @brief SplitMix64 finaliser: a fast bijective mix of 64 bits
+     * @param z Value to mix
+     * @return Mixed value with well-distributed bits
+     */
+    public static long mix64(long z) {
+        z = (z ^ (z >>> 30)) * 0xbf58476d1ce4e5b9L;
+        z = (z ^ (z >>> 27)) * 0x94d049bb133111ebL;
+        return z ^ (z >>> 31);
+    }
+
+    /**
+     * @brief Copies a list of values into a primitive array
+     * @param values List of values
+     * @return Array holding the same values
+     */
+    public static double[] toArray(List<Double> values) {
+        double[] out = new double[values.size()];
+        for (int i = 0; i < out.length; i++) {
+            out[i] = values.get(i);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Copies a primitive array into a list of values
+     * @param values Array of values
+     * @return List holding the same values
+     */
+    public static List<Double> toList(double[] values) {
+        List<Double> out = new ArrayList<>(values.length);
+        for (double v : values) {
+            out.add(v);
+        }
+        return out;
+    }
+}
+
+/**
+ * @brief Dense matrix kernels over row-major double arrays
+ */
+class MatrixOps {
+    /** Edge length of the square tiles used by the blocked kernels */
+    static final int BLOCK = 64;
+    /** Multiply-add count above which row blocks are processed in parallel */
+    static final long PARALLEL_THRESHOLD = 1L << 18;
+
+    /**
+     * @brief Computes C = A * B with cache-sized tiles, splitting row blocks across threads for large products
+     * @param a Row-major m x k matrix
+     * @param b Row-major k x n matrix
+     * @param m Rows of A
+     * @param k Columns of A and rows of B
+     * @param n Columns of B
+     * @return Row-major m x n product
+     */
+    public static double[] multiply(double[] a, double[] b, int m, int k, int n) {
+        double[] c = new double[m * n];
+        IntStream rowBlocks = IntStream.range(0, (m + BLOCK - 1) / BLOCK);
+        if ((long) m * k * n >= PARALLEL_THRESHOLD) {
+            rowBlocks = rowBlocks.parallel();
+        }
+        rowBlocks.forEach(block -> multiplyRows(a, b, c, k, n, block * BLOCK, Math.min(m, (block + 1) * BLOCK)));
+        return c;
+    }
+
+    /**
+     * @brief Accumulates rows [rowStart, rowEnd) of A * B into C, tiling over k and n
+     * @param a Row-major m x k matrix
+     * @param b Row-major k x n matrix
+     * @param c Row-major m x n output
+     * @param k Columns of A and rows of B
+     * @param n Columns of B
+     * @param rowStart First row of C to compute
+     * @param rowEnd One past the last row of C to compute
+     */
+    private static void multiplyRows(double[] a, double[] b, double[] c, int k, int n, int rowStart, int rowEnd) {
+        for (int kk = 0; kk < k; kk += BLOCK) {
+            int kEnd = Math.min(k, kk + BLOCK);
+            for (int jj = 0; jj < n; jj += BLOCK) {
+                int jEnd = Math.min(n, jj + BLOCK);
+                for (int i = rowStart; i < rowEnd; i++) {
+                    int cRow = i * n;
+                    for (int p = kk; p < kEnd; p++) {
+                        double aip = a[i * k + p];
+                        int bRow = p * n;
+                        for (int j = jj; j < jEnd; j++) {
+                            c[cRow + j] += aip * b[bRow + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Transposes a row-major matrix
+     * @param a Row-major rows x cols matrix
+     * @param rows Rows of A
+     * @param cols Columns of A
+     * @return Row-major cols x rows transpose
+     */
+    public static double[] transpose(double[] a, int rows, int cols) {
+        double[] t = new double[rows * cols];
+        for (int ii = 0; ii < rows; ii += BLOCK) {
+            for (int jj = 0; jj < cols; jj += BLOCK) {
+                for (int i = ii; i < Math.min(rows, ii + BLOCK); i++) {
+                    for (int j = jj; j < Math.min(cols, jj + BLOCK); j++) {
+                        t[j * rows + i] = a[i * cols + j];
+                    }
+                }
+            }
+        }
+        return t;
+    }
+
+    /**
+     * @brief Orthonormalises the columns of a matrix in place with modified Gram-Schmidt
+     *
+     * Columns that become numerically zero are left as zero vectors.
+     * @param a Row-major rows x cols matrix
+     * @param rows Rows of A
+     * @param cols Columns of A
+     */
+    public static void orthonormalizeColumns(double[] a, int rows, int cols) {
+        for (int j = 0; j < cols; j++) {
+            for (int p = 0; p < j; p++) {
+                double dot = 0.0;
+                for (int i = 0; i < rows; i++) {
+                    dot += a[i * cols + p] * a[i * cols + j];
+                }
+                for (int i = 0; i < rows; i++) {
+                    a[i * cols + j] -= dot * a[i * cols + p];
+                }
+            }
+            double norm = 0.0;
+            for (int i = 0; i < rows; i++) {
+                norm += a[i * cols + j] * a[i * cols + j];
+            }
+            norm = Math.sqrt(norm);
+            for (int i = 0; i < rows; i++) {
+                a[i * cols + j] = norm > 1e-12 ? a[i * cols + j] / norm : 0.0;
+            }
+        }
+    }
+
+    /**
+     * @brief Eigen-decomposes a symmetric matrix with cyclic Jacobi rotations
+     * @param a Row-major n x n symmetric matrix, destroyed by the call
+     * @param n Order of the matrix
+     * @param eigenvalues Output: the n eigenvalues, in no particular order
+     * @return Row-major n x n matrix whose columns are the matching unit eigenvectors
+     */
+    public static double[] symmetricEigen(double[] a, int n, double[] eigenvalues) {
+        double[] v = new double[n * n];
+        for (int i = 0; i < n; i++) {
+            v[i * n + i] = 1.0;
+        }
+
+        for (int sweep = 0; sweep < 100; sweep++) {
+            double off = 0.0;
+            double diag = 0.0;
+            for (int p = 0; p < n; p++) {
+                diag += a[p * n + p] * a[p * n + p];
+                for (int q = p + 1; q < n; q++) {
+                    off += a[p * n + q] * a[p * n + q];
+                }
+            }
+            if (off <= 1e-24 * diag || off == 0.0) {
+                break;
+            }
+
+            for (int p = 0; p < n; p++) {
+                for (int q = p + 1; q < n; q++) {
+                    double apq = a[p * n + q];
+                    if (apq == 0.0) {
+                        continue;
+                    }
+                    double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (Math.abs(theta) + Math.sqrt(theta * theta + 1.0));
+                    double c = 1.0 / Math.sqrt(t * t + 1.0);
+                    double s = t * c;
+                    for (int k = 0; k < n; k++) {
+                        double akp = a[k * n + p];
+                        double akq = a[k * n + q];
+                        a[k * n + p] = c * akp - s * akq;
+                        a[k * n + q] = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < n; k++) {
+                        double apk = a[p * n + k];
+                        double aqk = a[q * n + k];
+                        a[p * n + k] = c * apk - s * aqk;
+                        a[q * n + k] = s * apk + c * aqk;
+                    }
+                    for (int k = 0; k < n; k++) {
+                        double vkp = v[k * n + p];
+                        double vkq = v[k * n + q];
+                        v[k * n + p] = c * vkp - s * vkq;
+                        v[k * n + q] = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            eigenvalues[i] = a[i * n + i];
+        }
+        return v;
+    }
+}
+
+/**
+ * @brief Element-wise (or, for softmax, whole-vector) activation applied after a layer's weighted sums
+ *
+ * apply() is the fused epilogue of every layer: it adds the bias and applies
+ * the activation in the same pass over the output buffer. gradient() turns
+ * the gradient with respect to the outputs into the gradient with respect to
+ * the pre-activations; most derivatives are written in terms of the outputs,
+ * GELU and SiLU also need the pre-activations.
+ */
+enum Activation {
+    /** 1 / (1 + e^-x) */
+    SIGMOID,
+    /** max(0, x) */
+    RELU,
+    /** x for x > 0, LEAKY_SLOPE * x otherwise */
+    LEAKY_RELU,
+    /** Hyperbolic tangent */
+    TANH,
+    /** Gaussian error linear unit, tanh approximation */
+    GELU,
+    /** x * sigmoid(x), also known as swish */
+    SILU,
+    /** e^x_i / sum(e^x), computed with the maximum subtracted */
+    SOFTMAX,
+    /** x */
+    IDENTITY;
+
+    /** Slope of LEAKY_RELU for negative inputs */
+    static final double LEAKY_SLOPE = 0.01;
+    /** sqrt(2 / pi), used by the GELU approximation */
+    private static final double GELU_SCALE = Math.sqrt(2.0 / Math.PI);
+    /** Cubic coefficient of the GELU approximation */
+    private static final double GELU_CUBIC = 0.044715;
+
+    /**
+     * @brief Adds the bias to each weighted sum and applies the activation in one pass
+     * @param sums Weighted sums without bias
+     * @param bias Bias of each output
+     * @param out Output buffer; may be the same array as sums
+     */
+    public void apply(double[] sums, double[] bias, double[] out) {
+        int n = out.length;
+        switch (this) {
+            case SIGMOID:
+                for (int i = 0; i < n; i++) {
+                    out[i] = 1.0 / (1.0 + Math.exp(-(sums[i] + bias[i])));
+                }
+                break;
+            case RELU:
+                for (int i = 0; i < n; i++) {
+                    double v = sums[i] + bias[i];
+                    out[i] = v > 0.0 ? v : 0.0;
+                }
+                break;
+            case LEAKY_RELU:
+                for (int i = 0; i < n; i++) {
+                    double v = sums[i] + bias[i];
+                    out[i] = v > 0.0 ? v : LEAKY_SLOPE * v;
+                }
+                break;
+            case TANH:
+                for (int i = 0; i < n; i++) {
+                    out[i] = Math.tanh(sums[i] + bias[i]);
+                }
+                break;
+            case GELU:
+                for (int i = 0; i < n; i++) {
+                    double v = sums[i] + bias[i];
+                    out[i] = 0.5 * v * (1.0 + Math.tanh(GELU_SCALE * (v + GELU_CUBIC * v * v * v)));
+                }
+                break;
+            case SILU:
+                for (int i = 0; i < n; i++) {
+                    double v = sums[i] + bias[i];
+                    out[i] = v / (1.0 + Math.exp(-v));
+                }
+                break;
+            case SOFTMAX: {
+                double max = Double.NEGATIVE_INFINITY;
+                for (int i = 0; i < n; i++) {
+                    out[i] = sums[i] + bias[i];
+                    max = Math.max(max, out[i]);
+                }
+                double total = 0.0;
+                for (int i = 0; i < n; i++) {
+                    out[i] = Math.exp(out[i] - max);
+                    total += out[i];
+                }
+                double inv = 1.0 / total;
+                for (int i = 0; i < n; i++) {
+                    out[i] *= inv;
+                }
+                break;
+            }
+            default:
+                for (int i = 0; i < n; i++) {
+                    out[i] = sums[i] + bias[i];
+                }
+                break;
+        }
+    }
+
+    /**
+     * @brief Converts output gradients into pre-activation gradients
+     * @param preActivations Weighted sums including bias; only read when needsPreActivation() is true
+     * @param outputs Activation outputs
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each pre-activation
+     */
+    public double[] gradient(double[] preActivations, double[] outputs, double[] outputGradients) {
+        int n = outputs.length;
+        double[] delta = new double[n];
+        switch (this) {
+            case SIGMOID:
+                for (int i = 0; i < n; i++) {
+                    delta[i] = outputGradients[i] * outputs[i] * (1.0 - outputs[i]);
+                }
+                break;
+            case RELU:
+                for (int i = 0; i < n; i++) {
+                    delta[i] = outputs[i] > 0.0 ? outputGradients[i] : 0.0;
+                }
+                break;
+            case LEAKY_RELU:
+                for (int i = 0; i < n; i++) {
+                    delta[i] = outputs[i] > 0.0 ? outputGradients[i] : LEAKY_SLOPE * outputGradients[i];
+                }
+                break;
+            case TANH:
+                for (int i = 0; i < n; i++) {
+                    delta[i] = outputGradients[i] * (1.0 - outputs[i] * outputs[i]);
+                }
+                break;
+            case GELU:
+                for (int i = 0; i < n; i++) {
+                    double v = preActivations[i];
+                    double t = Math.tanh(GELU_SCALE * (v + GELU_CUBIC * v * v * v));
+                    double dt = (1.0 - t * t) * GELU_SCALE * (1.0 + 3.0 * GELU_CUBIC * v * v);
+                    delta[i] = outputGradients[i] * (0.5 * (1.0 + t) + 0.5 * v * dt);
+                }
+                break;
+            case SILU:
+                for (int i = 0; i < n; i++) {
+                    double v = preActivations[i];
+                    double sig = 1.0 / (1.0 + Math.exp(-v));
+                    delta[i] = outputGradients[i] * (sig + v * sig * (1.0 - sig));
+                }
+                break;
+            case SOFTMAX: {
+                double dot = 0.0;
+                for (int i = 0; i < n; i++) {
+                    dot += outputGradients[i] * outputs[i];
+                }
+                for (int i = 0; i < n; i++) {
+                    delta[i] = outputs[i] * (outputGradients[i] - dot);
+                }
+                break;
+            }
+            default:
+                System.arraycopy(outputGradients, 0, delta, 0, n);
+                break;
+        }
+        return delta;
+    }
+
+    /**
+     * @brief Whether gradient() needs the pre-activations as well as the outputs
+     * @return True for GELU and SiLU
+     */
+    public boolean needsPreActivation() {
+        return this == GELU || this == SILU;
+    }
 }
 
 /**
  * @brief Represents a single neuron in the neural network
  * 
  * Each neuron has weights for each input connection and a bias term.
- * It uses the sigmoid activation function.
+ * The activation function is applied by the owning Layer.
  */
 class Neuron {
     /** Weights for each input connection */
@@ -55,28 +448,21 @@ class Neuron {
     }
 
     /**
-     * @brief Computes the neuron's output for given inputs
-     * @param inputs List of input values
-     * @return Output of the neuron after applying the activation function
+     * @brief Constructs a neuron with given weights and bias
+     * @param weights Weights for each input connection
+     * @param bias Bias term
      */
-    public double activate(List<Double> inputs) {
-        if (inputs.size() != weights.size()) {
-            throw new IllegalArgumentException("Number of inputs must match number of weights");
-        }
-        
-        double sum = bias;
-        for (int i = 0; i < weights.size(); i++) {
-            sum += weights.get(i) * inputs.get(i);
-        }
-        return sigmoid(sum);
+    public Neuron(List<Double> weights, double bias) {
+        this.weights = new ArrayList<>(weights);
+        this.bias = bias;
     }
 
     /**
-     * @brief Sigmoid activation function
+     * @brief Sigmoid function, used by the recurrent layers' gates
      * @param x Input value
      * @return Sigmoid of x: 1/(1+e^(-x))
      */
-    private double sigmoid(double x) {
+    static double sigmoid(double x) {
         return 1.0 / (1.0 + Math.exp(-x));
     }
 
@@ -95,6 +481,14 @@ class Neuron {
     public double getBias() {
         return bias;
     }
+
+    /**
+     * @brief Set the bias of this neuron
+     * @param bias The new bias value
+     */
+    public void setBias(double bias) {
+        this.bias = bias;
+    }
 }
 
 /**
@@ -103,6 +497,22 @@ class Neuron {
 class Layer {
     /** List of neurons in this layer */
     private List<Neuron> neurons;
+    /**
+     * Accumulated gradients, allocated on first backward: row-major (neurons x inputs)
+     * weight gradients followed by one bias gradient per neuron, so one fill clears both
+     */
+    private double[] gradients;
+    /** Column-major (inputs x neurons) copy of the weights for sparse inputs, built on first use */
+    private volatile double[] columnMajorWeights;
+    /** Activation applied to the weighted sums, fused with the bias add */
+    private Activation activation = Activation.SIGMOID;
+
+    /**
+     * @brief Constructs a layer without neurons, for layers that store their weights in another form
+     */
+    protected Layer() {
+        neurons = new ArrayList<>();
+    }
 
     /**
      * @brief Constructs a layer with specified number of neurons
@@ -116,17 +526,180 @@ class Layer {
         }
     }
 
+    /**
+     * @brief Constructs a layer from existing neurons
+     * @param neurons Neurons of the layer, all with the same number of inputs
+     */
+    public Layer(List<Neuron> neurons) {
+        this.neurons = new ArrayList<>(neurons);
+    }
+
     /**
      * @brief Computes the outputs of all neurons in this layer
      * @param inputs List of input values to the layer
      * @return List of outputs from all neurons in the layer
      */
     public List<Double> activateLayer(List<Double> inputs) {
-        List<Double> outputs = new ArrayList<>();
-        for (Neuron neuron : neurons) {
-            outputs.add(neuron.activate(inputs));
+        double[] sums = weightedSums(Utils.toArray(inputs));
+        activation.apply(sums, getBiasVector(), sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Computes the outputs of all neurons for a sparse input vector
+     *
+     * Only the weight columns of the non-zero inputs are read, from a
+     * column-major copy of the weights so each column is contiguous, making the
+     * cost proportional to neurons x non-zeros rather than neurons x inputs.
+     * @param indices Positions of the non-zero inputs
+     * @param values Values of the non-zero inputs
+     * @return List of outputs from all neurons in the layer
+     */
+    public List<Double> activateSparse(int[] indices, double[] values) {
+        if (indices.length != values.length) {
+            throw new IllegalArgumentException("Sparse input must have one value per index");
         }
-        return outputs;
+        int cols = getInputSize();
+        for (int c : indices) {
+            if (c < 0 || c >= cols) {
+                throw new IllegalArgumentException("Sparse input index out of range: " + c);
+            }
+        }
+        if (neurons.isEmpty()) {
+            double[] dense = new double[cols];
+            for (int k = 0; k < indices.length; k++) {
+                dense[indices[k]] += values[k];
+            }
+            return activateLayer(Utils.toList(dense));
+        }
+
+        int rows = neurons.size();
+        double[] columnMajor = getColumnMajorWeights();
+        double[] sums = new double[rows];
+        for (int k = 0; k < indices.length; k++) {
+            int c = indices[k];
+            double x = values[k];
+            int base = c * rows;
+            for (int r = 0; r < rows; r++) {
+                sums[r] += columnMajor[base + r] * x;
+            }
+        }
+
+        activation.apply(sums, getBiasVector(), sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Back-propagates gradients through this layer and accumulates its parameter gradients
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        if (neurons.isEmpty()) {
+            throw new UnsupportedOperationException("This layer does not support training");
+        }
+        int cols = getInputSize();
+        int biasOffset = neurons.size() * cols;
+        if (gradients == null) {
+            gradients = new double[biasOffset + neurons.size()];
+        }
+
+        double[] x = Utils.toArray(inputs);
+        double[] preActivations = null;
+        if (activation.needsPreActivation()) {
+            preActivations = weightedSums(x);
+            double[] b = getBiasVector();
+            for (int r = 0; r < b.length; r++) {
+                preActivations[r] += b[r];
+            }
+        }
+        double[] deltas = activation.gradient(preActivations, Utils.toArray(outputs), Utils.toArray(outputGradients));
+
+        double[] inputGradients = new double[cols];
+        for (int r = 0; r < neurons.size(); r++) {
+            double delta = deltas[r];
+            gradients[biasOffset + r] += delta;
+            List<Double> w = neurons.get(r).getWeights();
+            int base = r * cols;
+            for (int c = 0; c < cols; c++) {
+                gradients[base + c] += delta * x[c];
+                inputGradients[c] += delta * w.get(c);
+            }
+        }
+        return Utils.toList(inputGradients);
+    }
+
+    /**
+     * @brief Takes a gradient descent step with the accumulated gradients and clears them
+     * @param learningRate Step size
+     */
+    public void applyGradients(double learningRate) {
+        if (gradients == null) {
+            return;
+        }
+        int cols = getInputSize();
+        int biasOffset = neurons.size() * cols;
+        for (int r = 0; r < neurons.size(); r++) {
+            Neuron neuron = neurons.get(r);
+            neuron.setBias(neuron.getBias() - learningRate * gradients[biasOffset + r]);
+            List<Double> w = neuron.getWeights();
+            int base = r * cols;
+            for (int c = 0; c < cols; c++) {
+                w.set(c, w.get(c) - learningRate * gradients[base + c]);
+            }
+        }
+        Arrays.fill(gradients, 0.0);
+        weightsChanged();
+    }
+
+    /**
+     * @brief Back-propagates gradients through a frozen layer without leaving parameter gradients behind
+     *
+     * Runs backward() and discards what it accumulated; layers whose gradient
+     * buffers are shared with other layers override this to skip accumulating.
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    public List<Double> backwardFrozen(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        List<Double> inputGradients = backward(inputs, outputs, outputGradients);
+        discardGradients();
+        return inputGradients;
+    }
+
+    /**
+     * @brief Clears the accumulated gradients without touching the parameters, e.g. for a frozen layer
+     */
+    public void discardGradients() {
+        if (gradients != null) {
+            Arrays.fill(gradients, 0.0);
+        }
+    }
+
+    /**
+     * @brief Drops caches derived from the weights; call after modifying neuron weights directly
+     */
+    public void weightsChanged() {
+        columnMajorWeights = null;
+    }
+
+    /**
+     * @brief Get the activation applied by this layer
+     * @return Activation function
+     */
+    public Activation getActivation() {
+        return activation;
+    }
+
+    /**
+     * @brief Set the activation applied by this layer
+     * @param activation Activation function
+     */
+    public void setActivation(Activation activation) {
+        this.activation = activation;
     }
 
     /**
@@ -136,119 +709,5855 @@ class Layer {
     public List<Neuron> getNeurons() {
         return neurons;
     }
-}
-
-/**
- * @brief Neural network implementation
- */
-class NeuralNetworkImpl {
-    /** List of layers in the network */
-    private List<Layer> layers;
 
     /**
-     * @brief Constructs a default neural network with 3 layers (3-3-3)
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
      */
-    public NeuralNetworkImpl() {
-        this(Arrays.asList(3, 3, 3));
+    public int getInputSize() {
+        return neurons.isEmpty() ? 0 : neurons.get(0).getWeights().size();
     }
 
     /**
-     * @brief Constructs a neural network with custom layer sizes
-     * @param layerSizes List containing the number of neurons in each layer
+     * @brief Computes each neuron's weighted sum of the inputs, without bias
+     * @param x Input values
+     * @return Weighted sum of each neuron
      */
-    public NeuralNetworkImpl(List<Integer> layerSizes) {
-        if (layerSizes.size() < 2) {
-            throw new IllegalArgumentException("Neural network must have at least 2 layers");
+    private double[] weightedSums(double[] x) {
+        if (x.length != getInputSize()) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
         }
-        
-        layers = new ArrayList<>();
-        
-        // Handle first layer specially
-        int firstInputSize = layerSizes.get(0); // For first layer, inputs = neurons for simplicity
-        layers.add(new Layer(layerSizes.get(0), firstInputSize));
-        
-        // For remaining layers, inputs come from previous layer
-        for (int i = 1; i < layerSizes.size(); i++) {
-            layers.add(new Layer(layerSizes.get(i), layerSizes.get(i-1)));
+        double[] sums = new double[neurons.size()];
+        for (int r = 0; r < sums.length; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            double sum = 0.0;
+            for (int c = 0; c < x.length; c++) {
+                sum += w.get(c) * x[c];
+            }
+            sums[r] = sum;
         }
+        return sums;
     }
 
     /**
-     * @brief Performs forward propagation through the network
-     * @param inputs List of input values to the network
-     * @return List of lists containing outputs at each layer, including the input
+     * @brief Copies the neurons' weights into a row-major matrix
+     * @return Row-major (neurons x inputs) weight matrix
      */
-    public List<List<Double>> forward(List<Double> inputs) {
-        if (inputs.size() != layers.get(0).getNeurons().get(0).getWeights().size()) {
-            throw new IllegalArgumentException("Input size must match first layer's input size");
+    public double[] getWeightMatrix() {
+        int cols = getInputSize();
+        double[] w = new double[neurons.size() * cols];
+        for (int r = 0; r < neurons.size(); r++) {
+            List<Double> row = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                w[r * cols + c] = row.get(c);
+            }
         }
-        
-        List<List<Double>> allOutputs = new ArrayList<>();
-        allOutputs.add(new ArrayList<>(inputs)); // Store the original input
-        
-        List<Double> currentOutputs = inputs;
-        
-        for (Layer layer : layers) {
-            currentOutputs = layer.activateLayer(currentOutputs);
-            allOutputs.add(new ArrayList<>(currentOutputs)); // Make a copy
+        return w;
+    }
+
+    /**
+     * @brief Get the weights as a column-major (inputs x neurons) array, built on first use and cached
+     *
+     * The cache is dropped by weightsChanged().
+     * @return Shared cached array; must not be modified
+     */
+    public double[] getColumnMajorWeights() {
+        double[] columnMajor = columnMajorWeights;
+        if (columnMajor == null) {
+            columnMajor = MatrixOps.transpose(getWeightMatrix(), neurons.size(), getInputSize());
+            columnMajorWeights = columnMajor;
         }
-        return allOutputs;
+        return columnMajor;
     }
 
     /**
-     * @brief Saves the network outputs to a JSON file
-     * @param filename Name of the file to save to
-     * @param layerOutputs List of lists containing outputs at each layer
+     * @brief Copies the neurons' biases into an array
+     * @return Bias of each neuron
      */
-    public void saveAsJson(String filename, List<List<Double>> layerOutputs) {
-        try (FileWriter file = new FileWriter(filename)) {
-            file.write("{\n  \"initial_input\": " + layerOutputs.get(0).toString() + ",\n");
-            
-            for (int i = 0; i < layers.size(); i++) {
-                file.write("  \"layer_" + (i + 1) + "_input\": " + layerOutputs.get(i).toString() + ",\n");
-                file.write("  \"layer_" + (i + 1) + "_output\": " + layerOutputs.get(i + 1).toString() + ",\n");
-            }
-            
-            file.write("  \"final_output\": " + layerOutputs.get(layerOutputs.size() - 1).toString() + "\n}");
-        } catch (IOException e) {
-            System.out.println("Unable to open file for writing: " + e.getMessage());
+    public double[] getBiasVector() {
+        double[] b = new double[neurons.size()];
+        for (int r = 0; r < neurons.size(); r++) {
+            b[r] = neurons.get(r).getBias();
         }
+        return b;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    public int getOutputSize() {
+        return neurons.size();
     }
 }
 
 /**
- * @brief Test class for neural network functionality
+ * @brief Fully connected layer with int8 weights and int32 accumulation
+ *
+ * Each output row stores its weights as signed bytes with its own scale, so
+ * w[r][c] ~= weights[r * cols + c] * rowScales[r]. Inputs are quantised to
+ * int8 with a single scale, either calibrated ahead of time from sample data
+ * or derived per call from the largest input magnitude. The source layer's
+ * activation is kept.
  */
-class NeuralNetworkTest {
+class QuantizedLayer extends Layer {
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Row-major int8 weights */
+    private final byte[] weights;
+    /** Dequantisation scale of each row */
+    private final float[] rowScales;
+    /** Bias of each row, kept in full precision */
+    private final double[] biases;
+    /** Calibrated input scale, or 0 to derive it from each input */
+    private float inputScale;
+
     /**
-     * @brief Tests forward propagation with default network
-     * @param dataSet Input data for testing
+     * @brief Quantises the weights of a dense layer
+     * @param layer Layer to convert
      */
-    public static void testForwardPropagation(List<Double> dataSet) {
-        NeuralNetworkImpl nn = new NeuralNetworkImpl();
-        List<List<Double>> outputs = nn.forward(dataSet);
-        Utils.consoleLog("Output from forward propagation: ", 33);
-        System.out.println(outputs.get(outputs.size() - 1));
-        nn.saveAsJson("neuralNetwork.json", outputs);
+    public QuantizedLayer(Layer layer) {
+        List<Neuron> neurons = layer.getNeurons();
+        if (neurons.isEmpty()) {
+            throw new IllegalArgumentException("Only dense layers can be quantised");
+        }
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        weights = new byte[rows * cols];
+        rowScales = new float[rows];
+        biases = new double[rows];
+
+        for (int r = 0; r < rows; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            double maxAbs = 0.0;
+            for (double v : w) {
+                maxAbs = Math.max(maxAbs, Math.abs(v));
+            }
+            double scale = maxAbs > 0.0 ? maxAbs / 127.0 : 1.0;
+            for (int c = 0; c < cols; c++) {
+                weights[r * cols + c] = quantize(w.get(c), scale);
+            }
+            rowScales[r] = (float) scale;
+            biases[r] = neurons.get(r).getBias();
+        }
+        setActivation(layer.getActivation());
     }
 
     /**
-     * @brief Tests forward propagation with custom network
-     * @param inputNeurons Number of neurons in input layer
-     * @param hiddenNeurons Number of neurons in hidden layer
-     * @param outputNeurons Number of neurons in output layer
-     * @param dataSet Input data for testing
+     * @brief Fixes the input scale from the largest magnitude seen during calibration
+     * @param maxAbsInput Largest absolute input value observed for this layer
      */
-    public static void testCustomNetwork(int inputNeurons, int hiddenNeurons, int outputNeurons, List<Double> dataSet) {
-        if (dataSet.size() != inputNeurons) {
-            throw new IllegalArgumentException("Input data size must match number of input neurons");
+    public void calibrate(double maxAbsInput) {
+        inputScale = maxAbsInput > 0.0 ? (float) (maxAbsInput / 127.0) : 0.0f;
+    }
+
+    /**
+     * @brief Computes the outputs of all rows using integer dot products
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
         }
-        
-        NeuralNetworkImpl nnCustom = new NeuralNetworkImpl(Arrays.asList(inputNeurons, hiddenNeurons, outputNeurons));
-        List<List<Double>> outputs = nnCustom.forward(dataSet);
-        Utils.consoleLog("Output from custom network forward propagation: ", 33);
-        System.out.println(outputs.get(outputs.size() - 1));
-        nnCustom.saveAsJson("neuralNetwork.json", outputs);
+
+        double scale = inputScale;
+        if (scale == 0.0) {
+            double maxAbs = 0.0;
+            for (double v : inputs) {
+                maxAbs = Math.max(maxAbs, Math.abs(v));
+            }
+            scale = maxAbs > 0.0 ? maxAbs / 127.0 : 1.0;
+        }
+
+        byte[] q = new byte[cols];
+        for (int c = 0; c < cols; c++) {
+            q[c] = quantize(inputs.get(c), scale);
+        }
+
+        double[] sums = new double[rows];
+        for (int r = 0; r < rows; r++) {
+            int acc = 0;
+            int base = r * cols;
+            for (int c = 0; c < cols; c++) {
+                acc += weights[base + c] * q[c];
+            }
+            sums[r] = acc * (double) rowScales[r] * scale;
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+
+    /**
+     * @brief Rounds a value to the nearest int8 step, saturating at +-127
+     * @param value Value to quantise
+     * @param scale Size of one int8 step
+     * @return Quantised value
+     */
+    private static byte quantize(double value, double scale) {
+        long q = Math.round(value / scale);
+        return (byte) Math.max(-127, Math.min(127, q));
+    }
+}
+
+/**
+ * @brief Fully connected layer with 16-bit weights expanded to float in the kernel
+ *
+ * Weights are stored either as IEEE half precision (fp16) or as bfloat16,
+ * halving the bytes streamed per row compared to float32. Each weight is
+ * widened to float as it is loaded and accumulated in float.
+ */
+class HalfPrecisionLayer extends Layer {
+    /**
+     * @brief Supported 16-bit storage formats
+     */
+    public enum Format {
+        /** IEEE 754 binary16: 5 exponent bits, 10 mantissa bits */
+        FP16,
+        /** bfloat16: float32 truncated to 8 exponent bits, 7 mantissa bits */
+        BF16
+    }
+
+    /** Storage format of the weights */
+    private final Format format;
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Row-major 16-bit weights */
+    private final short[] weights;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Converts the weights of a dense layer to a 16-bit format
+     * @param layer Layer to convert
+     * @param format Storage format to use
+     */
+    public HalfPrecisionLayer(Layer layer, Format format) {
+        List<Neuron> neurons = layer.getNeurons();
+        if (neurons.isEmpty()) {
+            throw new IllegalArgumentException("Only dense layers can be converted to 16-bit weights");
+        }
+        this.format = format;
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        weights = new short[rows * cols];
+        biases = new double[rows];
+
+        for (int r = 0; r < rows; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                float v = w.get(c).floatValue();
+                weights[r * cols + c] = format == Format.FP16 ? floatToHalf(v) : floatToBFloat16(v);
+            }
+            biases[r] = neurons.get(r).getBias();
+        }
+        setActivation(layer.getActivation());
+    }
+
+    /**
+     * @brief Computes the outputs of all rows, widening weights to float as they are read
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+
+        float[] x = new float[cols];
+        for (int c = 0; c < cols; c++) {
+            x[c] = inputs.get(c).floatValue();
+        }
+
+        double[] sums = new double[rows];
+        for (int r = 0; r < rows; r++) {
+            int base = r * cols;
+            float sum = 0.0f;
+            if (format == Format.FP16) {
+                for (int c = 0; c < cols; c++) {
+                    sum += halfToFloat(weights[base + c]) * x[c];
+                }
+            } else {
+                for (int c = 0; c < cols; c++) {
+                    sum += Float.intBitsToFloat(weights[base + c] << 16) * x[c];
+                }
+            }
+            sums[r] = sum;
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the storage format of the weights
+     * @return FP16 or BF16
+     */
+    public Format getFormat() {
+        return format;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+
+    /**
+     * @brief Rounds a float to IEEE half precision, to nearest even
+     *
+     * Done with bit operations rather than Float.floatToFloat16 so the
+     * code does not require Java 20.
+     * @param f Value to convert
+     * @return Bits of the fp16 value
+     */
+    static short floatToHalf(float f) {
+        int bits = Float.floatToIntBits(f);
+        int sign = (bits >>> 16) & 0x8000;
+        int exp = (bits >>> 23) & 0xff;
+        int mant = bits & 0x7fffff;
+
+        if (exp == 0xff) {
+            return (short) (sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+        }
+        int e = exp - 127 + 15;
+        if (e >= 0x1f) {
+            return (short) (sign | 0x7c00);
+        }
+        if (e <= 0) {
+            // Subnormal half: shift the full significand down to units of 2^-24
+            if (e < -10) {
+                return (short) sign;
+            }
+            mant |= 0x800000;
+            int shift = 14 - e;
+            int half = mant >> shift;
+            int rem = mant & ((1 << shift) - 1);
+            int mid = 1 << (shift - 1);
+            if (rem > mid || (rem == mid && (half & 1) != 0)) {
+                half++;
+            }
+            return (short) (sign | half);
+        }
+
+        // A carry out of the mantissa correctly bumps the exponent, up to infinity
+        int half = (e << 10) | (mant >> 13);
+        int rem = mant & 0x1fff;
+        if (rem > 0x1000 || (rem == 0x1000 && (half & 1) != 0)) {
+            half++;
+        }
+        return (short) (sign | half);
+    }
+
+    /**
+     * @brief Widens an IEEE half precision value to float
+     * @param h Bits of the fp16 value
+     * @return Equivalent float
+     */
+    static float halfToFloat(short h) {
+        int bits = h & 0xffff;
+        int sign = (bits & 0x8000) << 16;
+        int exp = (bits >>> 10) & 0x1f;
+        int mant = bits & 0x3ff;
+
+        if (exp == 0x1f) {
+            return Float.intBitsToFloat(sign | 0x7f800000 | (mant << 13));
+        }
+        if (exp == 0) {
+            float v = mant * 0x1p-24f;
+            return sign != 0 ? -v : v;
+        }
+        return Float.intBitsToFloat(sign | ((exp + 112) << 23) | (mant << 13));
+    }
+
+    /**
+     * @brief Rounds a float to bfloat16, to nearest even
+     * @param f Value to convert
+     * @return Bits of the bf16 value
+     */
+    static short floatToBFloat16(float f) {
+        int bits = Float.floatToIntBits(f);
+        if (Float.isNaN(f)) {
+            return (short) ((bits >>> 16) | 0x40);
+        }
+        return (short) ((bits + 0x7fff + ((bits >>> 16) & 1)) >>> 16);
+    }
+}
+
+/**
+ * @brief Fully connected layer whose weights are indices into a small codebook
+ *
+ * All weights of the layer are clustered with k-means into at most 256
+ * centroids. Each weight is stored as the index of its centroid, packed two
+ * per byte when the codebook has 16 entries or fewer, and is decoded by a
+ * table lookup inside the dot-product loop.
+ */
+class CodebookLayer extends Layer {
+    /** Number of k-means refinement passes */
+    private static final int KMEANS_ITERATIONS = 20;
+
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Centroid values shared by all weights of the layer */
+    private final float[] codebook;
+    /** Row-major centroid indices, 4 or 8 bits each */
+    private final byte[] indices;
+    /** Whether two 4-bit indices are packed into each byte */
+    private final boolean packed;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Clusters the weights of a dense layer into a codebook
+     * @param layer Layer to compress
+     * @param clusters Number of centroids, between 2 and 256
+     */
+    public CodebookLayer(Layer layer, int clusters) {
+        if (clusters < 2 || clusters > 256) {
+            throw new IllegalArgumentException("Number of clusters must be between 2 and 256");
+        }
+        List<Neuron> neurons = layer.getNeurons();
+        if (neurons.isEmpty()) {
+            throw new IllegalArgumentException("Only dense layers can be compressed");
+        }
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        biases = new double[rows];
+
+        double[] w = new double[rows * cols];
+        for (int r = 0; r < rows; r++) {
+            List<Double> row = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                w[r * cols + c] = row.get(c);
+            }
+            biases[r] = neurons.get(r).getBias();
+        }
+
+        int[] assignment = new int[w.length];
+        codebook = kMeans(w, clusters, assignment);
+        packed = clusters <= 16;
+        indices = new byte[packed ? (w.length + 1) / 2 : w.length];
+        for (int i = 0; i < w.length; i++) {
+            if (packed) {
+                indices[i >> 1] |= (byte) (assignment[i] << ((i & 1) << 2));
+            } else {
+                indices[i] = (byte) assignment[i];
+            }
+        }
+        setActivation(layer.getActivation());
+    }
+
+    /**
+     * @brief Computes the outputs of all rows, decoding weights from the codebook
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+        double[] x = Utils.toArray(inputs);
+
+        double[] sums = new double[rows];
+        for (int r = 0; r < rows; r++) {
+            int base = r * cols;
+            double sum = 0.0;
+            if (packed) {
+                for (int c = 0; c < cols; c++) {
+                    int i = base + c;
+                    sum += codebook[(indices[i >> 1] >> ((i & 1) << 2)) & 0xf] * x[c];
+                }
+            } else {
+                for (int c = 0; c < cols; c++) {
+                    sum += codebook[indices[base + c] & 0xff] * x[c];
+                }
+            }
+            sums[r] = sum;
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the centroid values of the codebook
+     * @return Codebook entries
+     */
+    public float[] getCodebook() {
+        return codebook;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+
+    /**
+     * @brief One-dimensional k-means with centroids initialised evenly between min and max
+     * @param values Values to cluster
+     * @param k Number of centroids
+     * @param assignment Output: index of the centroid each value belongs to
+     * @return Centroid values
+     */
+    private static float[] kMeans(double[] values, int k, int[] assignment) {
+        double min = Double.POSITIVE_INFINITY;
+        double max = Double.NEGATIVE_INFINITY;
+        for (double v : values) {
+            min = Math.min(min, v);
+            max = Math.max(max, v);
+        }
+        double[] centroids = new double[k];
+        for (int j = 0; j < k; j++) {
+            centroids[j] = values.length == 0 ? 0.0 : min + (max - min) * j / (k - 1);
+        }
+
+        double[] sums = new double[k];
+        int[] counts = new int[k];
+        for (int iter = 0; iter < KMEANS_ITERATIONS; iter++) {
+            boolean changed = false;
+            Arrays.fill(sums, 0.0);
+            Arrays.fill(counts, 0);
+            for (int i = 0; i < values.length; i++) {
+                int best = 0;
+                double bestDist = Double.POSITIVE_INFINITY;
+                for (int j = 0; j < k; j++) {
+                    double d = Math.abs(values[i] - centroids[j]);
+                    if (d < bestDist) {
+                        bestDist = d;
+                        best = j;
+                    }
+                }
+                if (iter == 0 || assignment[i] != best) {
+                    changed = true;
+                    assignment[i] = best;
+                }
+                sums[best] += values[i];
+                counts[best]++;
+            }
+            for (int j = 0; j < k; j++) {
+                if (counts[j] > 0) {
+                    centroids[j] = sums[j] / counts[j];
+                }
+            }
+            if (!changed) {
+                break;
+            }
+        }
+
+        float[] codebook = new float[k];
+        for (int j = 0; j < k; j++) {
+            codebook[j] = (float) centroids[j];
+        }
+        return codebook;
+    }
+}
+
+/**
+ * @brief Fully connected layer with +-1 weights and activations packed into 64-bit words
+ *
+ * A set bit encodes +1 and a clear bit -1, so the dot product of two packed
+ * vectors of length n is n - 2 * popcount(w XOR x). The layer keeps one
+ * scaling factor, the mean absolute weight, and uses the sign function as
+ * its activation.
+ */
+class BinaryLayer extends Layer {
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Number of 64-bit words per packed row */
+    private final int words;
+    /** Row-major packed weight signs */
+    private final long[] weights;
+    /** Mean absolute weight of the original layer */
+    private final double scale;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Binarises the weights of a dense layer
+     * @param layer Layer to convert
+     */
+    public BinaryLayer(Layer layer) {
+        List<Neuron> neurons = layer.getNeurons();
+        if (neurons.isEmpty()) {
+            throw new IllegalArgumentException("Only dense layers can be binarised");
+        }
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        words = (cols + 63) >>> 6;
+        weights = new long[rows * words];
+        biases = new double[rows];
+
+        double absSum = 0.0;
+        for (int r = 0; r < rows; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                double v = w.get(c);
+                absSum += Math.abs(v);
+                if (v >= 0.0) {
+                    weights[r * words + (c >>> 6)] |= 1L << c;
+                }
+            }
+            biases[r] = neurons.get(r).getBias();
+        }
+        scale = rows * cols > 0 ? absSum / (rows * cols) : 0.0;
+    }
+
+    /**
+     * @brief Computes the sign of each row's scaled XNOR-popcount dot product
+     * @param inputs List of input values, binarised by sign
+     * @return List of +1.0 / -1.0 outputs
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+
+        long[] x = new long[words];
+        double absSum = 0.0;
+        for (int c = 0; c < cols; c++) {
+            double v = inputs.get(c);
+            absSum += Math.abs(v);
+            if (v >= 0.0) {
+                x[c >>> 6] |= 1L << c;
+            }
+        }
+        double alpha = scale * (cols > 0 ? absSum / cols : 0.0);
+
+        List<Double> outputs = new ArrayList<>(rows);
+        for (int r = 0; r < rows; r++) {
+            int base = r * words;
+            int mismatches = 0;
+            for (int k = 0; k < words; k++) {
+                mismatches += Long.bitCount(weights[base + k] ^ x[k]);
+            }
+            int dot = cols - 2 * mismatches;
+            outputs.add(alpha * dot + biases[r] >= 0.0 ? 1.0 : -1.0);
+        }
+        return outputs;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+}
+
+/**
+ * @brief Fully connected layer with {-1, 0, +1} weights and activations in two bit planes
+ *
+ * Each vector is packed as a mask of +1 positions and a mask of -1 positions,
+ * so the dot product is popcount(wp & xp) + popcount(wn & xn)
+ * - popcount(wp & xn) - popcount(wn & xp). Values whose magnitude is below
+ * 0.7 times the mean magnitude become zero; the weight scale is the mean
+ * magnitude of the weights that survive.
+ */
+class TernaryLayer extends Layer {
+    /** Fraction of the mean magnitude below which a value is treated as zero */
+    private static final double THRESHOLD_RATIO = 0.7;
+
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Number of 64-bit words per packed row */
+    private final int words;
+    /** Row-major packed masks of +1 weights */
+    private final long[] positive;
+    /** Row-major packed masks of -1 weights */
+    private final long[] negative;
+    /** Mean magnitude of the non-zero weights */
+    private final double scale;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Ternarises the weights of a dense layer
+     * @param layer Layer to convert
+     */
+    public TernaryLayer(Layer layer) {
+        List<Neuron> neurons = layer.getNeurons();
+        if (neurons.isEmpty()) {
+            throw new IllegalArgumentException("Only dense layers can be ternarised");
+        }
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        words = (cols + 63) >>> 6;
+        positive = new long[rows * words];
+        negative = new long[rows * words];
+        biases = new double[rows];
+
+        double absSum = 0.0;
+        for (Neuron neuron : neurons) {
+            for (double v : neuron.getWeights()) {
+                absSum += Math.abs(v);
+            }
+        }
+        double threshold = rows * cols > 0 ? THRESHOLD_RATIO * absSum / (rows * cols) : 0.0;
+
+        double keptSum = 0.0;
+        int kept = 0;
+        for (int r = 0; r < rows; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                double v = w.get(c);
+                if (v > threshold) {
+                    positive[r * words + (c >>> 6)] |= 1L << c;
+                } else if (v < -threshold) {
+                    negative[r * words + (c >>> 6)] |= 1L << c;
+                } else {
+                    continue;
+                }
+                keptSum += Math.abs(v);
+                kept++;
+            }
+            biases[r] = neurons.get(r).getBias();
+        }
+        scale = kept > 0 ? keptSum / kept : 0.0;
+    }
+
+    /**
+     * @brief Computes the sign of each row's scaled ternary dot product
+     * @param inputs List of input values, ternarised with the same threshold rule as the weights
+     * @return List of +1.0 / 0.0 / -1.0 outputs
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+
+        double absSum = 0.0;
+        for (double v : inputs) {
+            absSum += Math.abs(v);
+        }
+        double threshold = cols > 0 ? THRESHOLD_RATIO * absSum / cols : 0.0;
+
+        long[] xp = new long[words];
+        long[] xn = new long[words];
+        double keptSum = 0.0;
+        int kept = 0;
+        for (int c = 0; c < cols; c++) {
+            double v = inputs.get(c);
+            if (v > threshold) {
+                xp[c >>> 6] |= 1L << c;
+            } else if (v < -threshold) {
+                xn[c >>> 6] |= 1L << c;
+            } else {
+                continue;
+            }
+            keptSum += Math.abs(v);
+            kept++;
+        }
+        double alpha = scale * (kept > 0 ? keptSum / kept : 0.0);
+
+        List<Double> outputs = new ArrayList<>(rows);
+        for (int r = 0; r < rows; r++) {
+            int base = r * words;
+            int dot = 0;
+            for (int k = 0; k < words; k++) {
+                long wp = positive[base + k];
+                long wn = negative[base + k];
+                dot += Long.bitCount(wp & xp[k]) + Long.bitCount(wn & xn[k])
+                        - Long.bitCount(wp & xn[k]) - Long.bitCount(wn & xp[k]);
+            }
+            outputs.add(Math.signum(alpha * dot + biases[r]));
+        }
+        return outputs;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+}
+
+/**
+ * @brief Fully connected layer storing only its non-zero weights in CSR form
+ *
+ * Row r's non-zeros are values[rowStart[r] .. rowStart[r + 1]) at columns
+ * columns[...], so the cost of a forward pass scales with the number of
+ * non-zero weights rather than rows * cols.
+ */
+class CsrLayer extends Layer {
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Offset of each row's first non-zero, plus a final end offset */
+    private final int[] rowStart;
+    /** Column index of each non-zero */
+    private final int[] columns;
+    /** Value of each non-zero */
+    private final double[] values;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Compresses the non-zero weights of a dense layer
+     * @param layer Layer to convert, usually after magnitude pruning
+     */
+    public CsrLayer(Layer layer) {
+        List<Neuron> neurons = layer.getNeurons();
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        rowStart = new int[rows + 1];
+        biases = new double[rows];
+
+        int nnz = 0;
+        for (Neuron neuron : neurons) {
+            for (double v : neuron.getWeights()) {
+                if (v != 0.0) {
+                    nnz++;
+                }
+            }
+        }
+        columns = new int[nnz];
+        values = new double[nnz];
+
+        int k = 0;
+        for (int r = 0; r < rows; r++) {
+            List<Double> w = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                double v = w.get(c);
+                if (v != 0.0) {
+                    columns[k] = c;
+                    values[k] = v;
+                    k++;
+                }
+            }
+            rowStart[r + 1] = k;
+            biases[r] = neurons.get(r).getBias();
+        }
+        setActivation(layer.getActivation());
+    }
+
+    /**
+     * @brief Computes the outputs of all rows from their non-zero weights
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+        double[] x = Utils.toArray(inputs);
+
+        double[] sums = new double[rows];
+        for (int r = 0; r < rows; r++) {
+            double sum = 0.0;
+            for (int k = rowStart[r]; k < rowStart[r + 1]; k++) {
+                sum += values[k] * x[columns[k]];
+            }
+            sums[r] = sum;
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the number of stored non-zero weights
+     * @return Non-zero count
+     */
+    public int getNonZeroCount() {
+        return values.length;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+}
+
+/**
+ * @brief Fully connected layer storing only the BLOCK_ROWS x BLOCK_COLS tiles that contain non-zeros
+ *
+ * Each stored tile is dense, so its inner loop has a fixed trip count and no
+ * index indirection, which the JIT can unroll and vectorise. Tiles are kept
+ * in CSR order by block row.
+ */
+class BlockSparseLayer extends Layer {
+    /** Rows per tile */
+    static final int BLOCK_ROWS = 4;
+    /** Columns per tile */
+    static final int BLOCK_COLS = 8;
+
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Offset of each block row's first tile, plus a final end offset */
+    private final int[] blockStart;
+    /** Block column index of each stored tile */
+    private final int[] blockColumns;
+    /** Row-major contents of each stored tile, zero padded at the matrix edges */
+    private final double[] values;
+    /** Bias of each row */
+    private final double[] biases;
+
+    /**
+     * @brief Compresses the non-zero tiles of a dense layer
+     * @param layer Layer to convert, usually after magnitude pruning
+     */
+    public BlockSparseLayer(Layer layer) {
+        List<Neuron> neurons = layer.getNeurons();
+        rows = neurons.size();
+        cols = layer.getInputSize();
+        int blockRowCount = (rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+        int blockColCount = (cols + BLOCK_COLS - 1) / BLOCK_COLS;
+        blockStart = new int[blockRowCount + 1];
+        biases = new double[rows];
+
+        double[] w = new double[rows * cols];
+        for (int r = 0; r < rows; r++) {
+            List<Double> row = neurons.get(r).getWeights();
+            for (int c = 0; c < cols; c++) {
+                w[r * cols + c] = row.get(c);
+            }
+            biases[r] = neurons.get(r).getBias();
+        }
+
+        List<Integer> tileColumns = new ArrayList<>();
+        for (int br = 0; br < blockRowCount; br++) {
+            for (int bc = 0; bc < blockColCount; bc++) {
+                if (tileHasNonZero(w, br, bc)) {
+                    tileColumns.add(bc);
+                }
+            }
+            blockStart[br + 1] = tileColumns.size();
+        }
+
+        blockColumns = new int[tileColumns.size()];
+        values = new double[tileColumns.size() * BLOCK_ROWS * BLOCK_COLS];
+        for (int br = 0; br < blockRowCount; br++) {
+            for (int t = blockStart[br]; t < blockStart[br + 1]; t++) {
+                int bc = tileColumns.get(t);
+                blockColumns[t] = bc;
+                int off = t * BLOCK_ROWS * BLOCK_COLS;
+                for (int i = 0; i < BLOCK_ROWS; i++) {
+                    int r = br * BLOCK_ROWS + i;
+                    for (int j = 0; j < BLOCK_COLS; j++) {
+                        int c = bc * BLOCK_COLS + j;
+                        if (r < rows && c < cols) {
+                            values[off + i * BLOCK_COLS + j] = w[r * cols + c];
+                        }
+                    }
+                }
+            }
+        }
+        setActivation(layer.getActivation());
+    }
+
+    /**
+     * @brief Computes the outputs of all rows tile by tile
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+        // Pad the input to whole tiles so the inner loop never needs a bounds check
+        int blockColCount = (cols + BLOCK_COLS - 1) / BLOCK_COLS;
+        double[] x = new double[blockColCount * BLOCK_COLS];
+        for (int c = 0; c < cols; c++) {
+            x[c] = inputs.get(c);
+        }
+
+        double[] sums = new double[rows];
+        double[] acc = new double[BLOCK_ROWS];
+        for (int br = 0; br + 1 < blockStart.length; br++) {
+            Arrays.fill(acc, 0.0);
+            for (int t = blockStart[br]; t < blockStart[br + 1]; t++) {
+                int off = t * BLOCK_ROWS * BLOCK_COLS;
+                int xOff = blockColumns[t] * BLOCK_COLS;
+                for (int i = 0; i < BLOCK_ROWS; i++) {
+                    double sum = 0.0;
+                    for (int j = 0; j < BLOCK_COLS; j++) {
+                        sum += values[off + i * BLOCK_COLS + j] * x[xOff + j];
+                    }
+                    acc[i] += sum;
+                }
+            }
+            for (int i = 0; i < BLOCK_ROWS; i++) {
+                int r = br * BLOCK_ROWS + i;
+                if (r < rows) {
+                    sums[r] = acc[i];
+                }
+            }
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the number of stored tiles
+     * @return Tile count
+     */
+    public int getBlockCount() {
+        return blockColumns.length;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+
+    /**
+     * @brief Checks whether a tile of a row-major matrix has any non-zero entry
+     * @param w Row-major weights
+     * @param br Block row index
+     * @param bc Block column index
+     * @return True if the tile must be stored
+     */
+    private boolean tileHasNonZero(double[] w, int br, int bc) {
+        for (int r = br * BLOCK_ROWS; r < Math.min(rows, (br + 1) * BLOCK_ROWS); r++) {
+            for (int c = bc * BLOCK_COLS; c < Math.min(cols, (bc + 1) * BLOCK_COLS); c++) {
+                if (w[r * cols + c] != 0.0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+}
+
+/**
+ * @brief Fully connected layer whose weight matrix is stored as the product U * V
+ *
+ * With U of size rows x rank and V of size rank x cols, a forward pass costs
+ * rank * (rows + cols) multiply-adds instead of rows * cols. The factors are
+ * found with a randomised truncated SVD: the range of W is sampled with a
+ * Gaussian test matrix and two power iterations, W is projected onto that
+ * basis, and the small projected matrix is decomposed exactly.
+ */
+class LowRankLayer extends Layer {
+    /** Extra sampled directions beyond the requested rank */
+    private static final int OVERSAMPLING = 8;
+    /** Power iterations used to sharpen the sampled range */
+    private static final int POWER_ITERATIONS = 2;
+
+    /** Number of output rows */
+    private final int rows;
+    /** Number of input columns */
+    private final int cols;
+    /** Inner dimension of the factorisation */
+    private final int rank;
+    /** Row-major rows x rank left factor */
+    private final double[] u;
+    /** Row-major rank x cols right factor */
+    private final double[] v;
+    /** Bias of each row */
+    private final double[] biases;
+    /** Relative Frobenius reconstruction error for ranks 1, 2, ... of the sampled basis */
+    private final double[] errors;
+
+    /**
+     * @brief Factorises the weights of a dense layer at the given rank
+     * @param layer Layer to convert
+     * @param rank Rank of the factorisation, at least 1
+     * @param seed Seed of the random test matrix
+     */
+    public LowRankLayer(Layer layer, int rank, long seed) {
+        rows = layer.getOutputSize();
+        cols = layer.getInputSize();
+        if (rank < 1) {
+            throw new IllegalArgumentException("Rank must be at least 1");
+        }
+        this.rank = Math.min(rank, Math.min(rows, cols));
+        biases = layer.getBiasVector();
+
+        double[] w = layer.getWeightMatrix();
+        double[] wt = MatrixOps.transpose(w, rows, cols);
+        int samples = Math.min(this.rank + OVERSAMPLING, Math.min(rows, cols));
+
+        Random rand = new Random(seed);
+        double[] omega = new double[cols * samples];
+        for (int i = 0; i < omega.length; i++) {
+            omega[i] = rand.nextGaussian();
+        }
+        double[] q = MatrixOps.multiply(w, omega, rows, cols, samples);
+        MatrixOps.orthonormalizeColumns(q, rows, samples);
+        for (int iter = 0; iter < POWER_ITERATIONS; iter++) {
+            double[] z = MatrixOps.multiply(wt, q, cols, rows, samples);
+            MatrixOps.orthonormalizeColumns(z, cols, samples);
+            q = MatrixOps.multiply(w, z, rows, cols, samples);
+            MatrixOps.orthonormalizeColumns(q, rows, samples);
+        }
+
+        // B = Q^T W is small; the eigenvectors of B B^T are its left singular vectors
+        double[] b = MatrixOps.multiply(MatrixOps.transpose(q, rows, samples), w, samples, rows, cols);
+        double[] gram = MatrixOps.multiply(b, MatrixOps.transpose(b, samples, cols), samples, cols, samples);
+        double[] eigenvalues = new double[samples];
+        double[] vectors = MatrixOps.symmetricEigen(gram, samples, eigenvalues);
+
+        Integer[] order = new Integer[samples];
+        for (int i = 0; i < samples; i++) {
+            order[i] = i;
+        }
+        Arrays.sort(order, (x, y) -> Double.compare(eigenvalues[y], eigenvalues[x]));
+
+        double total = 0.0;
+        for (double value : w) {
+            total += value * value;
+        }
+        errors = new double[samples];
+        double captured = 0.0;
+        for (int i = 0; i < samples; i++) {
+            captured += Math.max(0.0, eigenvalues[order[i]]);
+            errors[i] = total > 0.0 ? Math.sqrt(Math.max(0.0, total - captured) / total) : 0.0;
+        }
+
+        // U = Q * Ub[:, top], V = Ub[:, top]^T * B
+        double[] top = new double[samples * this.rank];
+        for (int i = 0; i < samples; i++) {
+            for (int j = 0; j < this.rank; j++) {
+                top[i * this.rank + j] = vectors[i * samples + order[j]];
+            }
+        }
+        u = MatrixOps.multiply(q, top, rows, samples, this.rank);
+        v = MatrixOps.multiply(MatrixOps.transpose(top, samples, this.rank), b, this.rank, samples, cols);
+        setActivation(layer.getActivation());
+    }
+
+    /**
+     * @brief Computes the outputs of all rows as U * (V * x)
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != cols) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+        double[] x = Utils.toArray(inputs);
+
+        double[] t = new double[rank];
+        for (int i = 0; i < rank; i++) {
+            double sum = 0.0;
+            for (int c = 0; c < cols; c++) {
+                sum += v[i * cols + c] * x[c];
+            }
+            t[i] = sum;
+        }
+
+        double[] sums = new double[rows];
+        for (int r = 0; r < rows; r++) {
+            double sum = 0.0;
+            for (int i = 0; i < rank; i++) {
+                sum += u[r * rank + i] * t[i];
+            }
+            sums[r] = sum;
+        }
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Get the relative reconstruction error ||W - W_k|| / ||W|| for each rank k
+     * @return Errors for ranks 1 up to the number of sampled directions
+     */
+    public double[] getReconstructionErrors() {
+        return errors;
+    }
+
+    /**
+     * @brief Get the rank of the factorisation
+     * @return Inner dimension of U * V
+     */
+    public int getRank() {
+        return rank;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return rows;
+    }
+}
+
+/**
+ * @brief Weight matrix that several layers, possibly in different networks, can reference
+ *
+ * Every layer using the buffer adds its weight gradients into the single
+ * gradient array and is recorded as a pending user. The buffer is stepped
+ * once per training step by its owner, normally the network whose layers
+ * use it, and the step is refused while layers outside that owner (e.g. of a
+ * network still accumulating micro-batches) have gradients pending.
+ */
+class SharedWeights {
+    /** Number of rows */
+    private final int rows;
+    /** Number of columns */
+    private final int cols;
+    /** Row-major values */
+    private final double[] values;
+    /** Row-major accumulated gradients */
+    private final double[] gradients;
+    /** Layers whose gradients are in the buffer but not yet applied */
+    private final Set<Layer> pendingUsers = new HashSet<>();
+
+    /**
+     * @brief Constructs a matrix with random Gaussian weights
+     * @param rows Number of rows
+     * @param cols Number of columns
+     */
+    public SharedWeights(int rows, int cols) {
+        this.rows = rows;
+        this.cols = cols;
+        values = new double[rows * cols];
+        gradients = new double[rows * cols];
+        Random rand = new Random();
+        for (int i = 0; i < values.length; i++) {
+            values[i] = rand.nextGaussian();
+        }
+    }
+
+    /**
+     * @brief Constructs a shared copy of a dense layer's weights
+     * @param layer Layer whose weights to copy
+     */
+    public SharedWeights(Layer layer) {
+        rows = layer.getOutputSize();
+        cols = layer.getInputSize();
+        values = layer.getWeightMatrix();
+        gradients = new double[rows * cols];
+    }
+
+    /**
+     * @brief Records that a layer has added its weight gradients to the buffer
+     * @param user Layer that back-propagated through the buffer
+     */
+    public void addPendingUser(Layer user) {
+        pendingUsers.add(user);
+    }
+
+    /**
+     * @brief Takes one gradient descent step with the accumulated gradients on behalf of the given layers and clears them
+     * @param learningRate Step size
+     * @param owner Layers the step is taken for, e.g. all layers of one network; every pending user must be among them
+     */
+    public void applyGradients(double learningRate, Collection<? extends Layer> owner) {
+        if (pendingUsers.isEmpty()) {
+            return;
+        }
+        if (!owner.containsAll(pendingUsers)) {
+            throw new IllegalStateException("Shared weights hold pending gradients of layers outside this step");
+        }
+        for (int i = 0; i < values.length; i++) {
+            values[i] -= learningRate * gradients[i];
+        }
+        Arrays.fill(gradients, 0.0);
+        pendingUsers.clear();
+    }
+
+    /**
+     * @brief Get the number of rows
+     * @return Row count
+     */
+    public int getRows() {
+        return rows;
+    }
+
+    /**
+     * @brief Get the number of columns
+     * @return Column count
+     */
+    public int getCols() {
+        return cols;
+    }
+
+    /**
+     * @brief Get the row-major values, shared by all users
+     * @return Weight values
+     */
+    public double[] getValues() {
+        return values;
+    }
+
+    /**
+     * @brief Get the row-major accumulated gradients, shared by all users
+     * @return Weight gradients
+     */
+    public double[] getGradients() {
+        return gradients;
+    }
+}
+
+/**
+ * @brief Fully connected layer whose weights live in a SharedWeights buffer
+ *
+ * The layer uses W directly, or W^T when transposed, as in an autoencoder
+ * whose decoder reuses the encoder weights. Biases are owned by the layer.
+ */
+class TiedLayer extends Layer {
+    /** Shared weight buffer */
+    private final SharedWeights shared;
+    /** Whether the layer computes W^T x instead of W x */
+    private final boolean transposed;
+    /** Bias of each output */
+    private final double[] biases;
+    /** Accumulated bias gradients */
+    private final double[] biasGradients;
+
+    /**
+     * @brief Constructs a layer over a shared weight buffer with zero biases
+     * @param shared Weight buffer to use
+     * @param transposed Whether to use the transpose of the buffer
+     */
+    public TiedLayer(SharedWeights shared, boolean transposed) {
+        this.shared = shared;
+        this.transposed = transposed;
+        biases = new double[getOutputSize()];
+        biasGradients = new double[getOutputSize()];
+    }
+
+    /**
+     * @brief Computes the outputs of the layer
+     * @param inputs List of input values to the layer
+     * @return List of outputs from all rows in the layer
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        double[] sums = weightedSums(Utils.toArray(inputs));
+        getActivation().apply(sums, biases, sums);
+        return Utils.toList(sums);
+    }
+
+    /**
+     * @brief Computes W x, or W^T x when transposed, without bias
+     * @param x Input values
+     * @return Weighted sum of each output
+     */
+    private double[] weightedSums(double[] x) {
+        if (x.length != getInputSize()) {
+            throw new IllegalArgumentException("Number of inputs must match number of weights");
+        }
+        double[] w = shared.getValues();
+        int cols = shared.getCols();
+        double[] sums = new double[getOutputSize()];
+
+        if (transposed) {
+            // Walk W row by row so the transpose is never materialised
+            for (int i = 0; i < shared.getRows(); i++) {
+                double xi = x[i];
+                for (int j = 0; j < cols; j++) {
+                    sums[j] += w[i * cols + j] * xi;
+                }
+            }
+        } else {
+            for (int i = 0; i < shared.getRows(); i++) {
+                double sum = 0.0;
+                for (int j = 0; j < cols; j++) {
+                    sum += w[i * cols + j] * x[j];
+                }
+                sums[i] = sum;
+            }
+        }
+        return sums;
+    }
+
+    /**
+     * @brief Back-propagates gradients and adds the weight gradients into the shared buffer
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        return propagate(inputs, outputs, outputGradients, true);
+    }
+
+    /**
+     * @brief Back-propagates gradients without touching the bias or shared weight gradients
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backwardFrozen(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        return propagate(inputs, outputs, outputGradients, false);
+    }
+
+    /**
+     * @brief Computes the input gradients and optionally accumulates the parameter gradients
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @param accumulate Whether to add bias and shared weight gradients
+     * @return Gradient of the loss with respect to each input
+     */
+    private List<Double> propagate(List<Double> inputs, List<Double> outputs, List<Double> outputGradients,
+                                   boolean accumulate) {
+        double[] w = shared.getValues();
+        double[] g = shared.getGradients();
+        int cols = shared.getCols();
+        double[] x = Utils.toArray(inputs);
+
+        double[] preActivations = null;
+        if (getActivation().needsPreActivation()) {
+            preActivations = weightedSums(x);
+            for (int r = 0; r < preActivations.length; r++) {
+                preActivations[r] += biases[r];
+            }
+        }
+        double[] delta = getActivation().gradient(preActivations, Utils.toArray(outputs), Utils.toArray(outputGradients));
+        if (accumulate) {
+            for (int r = 0; r < delta.length; r++) {
+                biasGradients[r] += delta[r];
+            }
+        }
+
+        double[] inputGradients = new double[x.length];
+        for (int i = 0; i < shared.getRows(); i++) {
+            int base = i * cols;
+            if (transposed) {
+                // Output j reads W[i][j] * x[i]
+                double sum = 0.0;
+                for (int j = 0; j < cols; j++) {
+                    if (accumulate) {
+                        g[base + j] += delta[j] * x[i];
+                    }
+                    sum += w[base + j] * delta[j];
+                }
+                inputGradients[i] = sum;
+            } else {
+                // Output i reads W[i][j] * x[j]
+                for (int j = 0; j < cols; j++) {
+                    if (accumulate) {
+                        g[base + j] += delta[i] * x[j];
+                    }
+                    inputGradients[j] += w[base + j] * delta[i];
+                }
+            }
+        }
+        if (accumulate) {
+            shared.addPendingUser(this);
+        }
+        return Utils.toList(inputGradients);
+    }
+
+    /**
+     * @brief Steps the biases with the accumulated gradients
+     *
+     * The shared weights are stepped once by their owner through
+     * SharedWeights.applyGradients, which NeuralNetworkImpl.applyGradients does.
+     * @param learningRate Step size
+     */
+    @Override
+    public void applyGradients(double learningRate) {
+        for (int r = 0; r < biases.length; r++) {
+            biases[r] -= learningRate * biasGradients[r];
+        }
+        Arrays.fill(biasGradients, 0.0);
+    }
+
+    /**
+     * @brief Clears this layer's bias gradients
+     *
+     * The shared weight gradients are left alone: they may hold contributions
+     * of other layers using the buffer. A frozen tied layer never adds to them,
+     * since the network back-propagates through it with backwardFrozen().
+     */
+    @Override
+    public void discardGradients() {
+        Arrays.fill(biasGradients, 0.0);
+    }
+
+    /**
+     * @brief Get the shared weight buffer
+     * @return Weight buffer used by this layer
+     */
+    public SharedWeights getSharedWeights() {
+        return shared;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return transposed ? shared.getRows() : shared.getCols();
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return transposed ? shared.getCols() : shared.getRows();
+    }
+}
+
+/**
+ * @brief Lookup table mapping categorical feature ids to dense vectors
+ *
+ * A bag of ids is embedded as the sum of their rows, which replaces a
+ * one-hot input times a huge first-layer matrix with a few row reads. In
+ * hashing mode any 64-bit id is mixed and reduced to one of a fixed number of
+ * rows, bounding the table size regardless of vocabulary. Gradients are kept
+ * only for the rows touched since the last step.
+ */
+class EmbeddingLayer {
+    /** Number of rows in the table */
+    private final int rows;
+    /** Length of each embedding vector */
+    private final int dimension;
+    /** Whether ids are hashed into the table rather than used as row numbers */
+    private final boolean hashed;
+    /** Row-major (rows x dimension) embedding table */
+    private final double[] table;
+    /** Accumulated gradient of each row touched since the last step */
+    private final Map<Integer, double[]> rowGradients = new HashMap<>();
+
+    /**
+     * @brief Constructs a table with small random entries
+     * @param rows Vocabulary size, or the number of hash buckets in hashing mode
+     * @param dimension Length of each embedding vector
+     * @param hashed Whether to hash ids into the table
+     */
+    public EmbeddingLayer(int rows, int dimension, boolean hashed) {
+        if (rows < 1 || dimension < 1) {
+            throw new IllegalArgumentException("Embedding table must have at least one row and one column");
+        }
+        this.rows = rows;
+        this.dimension = dimension;
+        this.hashed = hashed;
+        table = new double[rows * dimension];
+        Random rand = new Random();
+        double scale = 1.0 / Math.sqrt(dimension);
+        for (int i = 0; i < table.length; i++) {
+            table[i] = rand.nextGaussian() * scale;
+        }
+    }
+
+    /**
+     * @brief Embeds a bag of feature ids as the sum of their rows
+     * @param ids Feature ids present in the sample
+     * @return Summed embedding, of length getDimension()
+     */
+    public List<Double> lookup(long[] ids) {
+        double[] sum = new double[dimension];
+        for (long id : ids) {
+            int base = rowOf(id) * dimension;
+            for (int d = 0; d < dimension; d++) {
+                sum[d] += table[base + d];
+            }
+        }
+        return Utils.toList(sum);
+    }
+
+    /**
+     * @brief Accumulates the gradient of every row used by a bag of ids
+     * @param ids Feature ids passed to lookup()
+     * @param outputGradients Gradient of the loss with respect to the summed embedding
+     */
+    public void backward(long[] ids, List<Double> outputGradients) {
+        double[] g = Utils.toArray(outputGradients);
+        for (long id : ids) {
+            double[] rowGradient = rowGradients.computeIfAbsent(rowOf(id), k -> new double[dimension]);
+            for (int d = 0; d < dimension; d++) {
+                rowGradient[d] += g[d];
+            }
+        }
+    }
+
+    /**
+     * @brief Takes a gradient descent step on the touched rows only and clears their gradients
+     * @param learningRate Step size
+     */
+    public void applyGradients(double learningRate) {
+        for (Map.Entry<Integer, double[]> entry : rowGradients.entrySet()) {
+            int base = entry.getKey() * dimension;
+            double[] g = entry.getValue();
+            for (int d = 0; d < dimension; d++) {
+                table[base + d] -= learningRate * g[d];
+            }
+        }
+        rowGradients.clear();
+    }
+
+    /**
+     * @brief Get the length of each embedding vector
+     * @return Embedding dimension
+     */
+    public int getDimension() {
+        return dimension;
+    }
+
+    /**
+     * @brief Maps a feature id to its table row
+     * @param id Feature id
+     * @return Row index
+     */
+    private int rowOf(long id) {
+        if (!hashed) {
+            if (id < 0 || id >= rows) {
+                throw new IllegalArgumentException("Feature id out of range: " + id);
+            }
+            return (int) id;
+        }
+        // Mix first so nearby ids land in unrelated buckets
+        return (int) Math.floorMod(Utils.mix64(id), (long) rows);
+    }
+}
+
+/**
+ * @brief Decides per layer whether its input is sparse enough for the compressed-activation kernel
+ *
+ * The sparse kernel costs roughly a fixed time per non-zero input, the dense
+ * one a fixed time per call, so the break-even input density is
+ * dense / (perNonZero * width). Inputs without exact zeros always take the
+ * dense kernel and are not counted. Once WARMUP_CALLS inputs with zeros have
+ * run densely, both costs are measured on live inputs, and again every
+ * RETUNE_INTERVAL such inputs; the threshold follows the smoothed costs.
+ * Safe to share between threads evaluating the same network.
+ */
+class SparsityTuner {
+    /** Inputs with zeros evaluated densely before the first measurement */
+    static final int WARMUP_CALLS = 100;
+    /** Number of inputs with zeros between timing measurements */
+    static final int RETUNE_INTERVAL = 1000;
+    /** Timed evaluations of each kernel per measurement, of which the fastest counts */
+    private static final int MEASURE_REPEATS = 3;
+    /** Weight of a new measurement in the smoothed costs */
+    private static final double SMOOTHING = 0.25;
+
+    /** Input density below which the sparse kernel is used; 0 until the first measurement */
+    private volatile double threshold = 0.0;
+    /** Smoothed dense kernel time in nanoseconds, or negative before the first measurement */
+    private double denseNanos = -1.0;
+    /** Smoothed sparse kernel time per non-zero input in nanoseconds */
+    private double sparseNanosPerNonZero = -1.0;
+    /** Inputs containing zeros seen so far */
+    private long sparseCalls;
+
+    /**
+     * @brief Evaluates a layer, choosing the dense or compressed-activation kernel
+     * @param layer Layer to evaluate
+     * @param inputs Inputs to the layer
+     * @return Outputs of the layer
+     */
+    public List<Double> activate(Layer layer, List<Double> inputs) {
+        int nonZeros = 0;
+        for (double v : inputs) {
+            if (v != 0.0) {
+                nonZeros++;
+            }
+        }
+        // Layers without neurons only densify in activateSparse, so there is nothing to gain or measure
+        if (nonZeros == inputs.size() || layer.getNeurons().isEmpty()) {
+            return layer.activateLayer(inputs);
+        }
+        boolean measure = countSparseCall();
+        if (!measure && nonZeros >= threshold * inputs.size()) {
+            return layer.activateLayer(inputs);
+        }
+
+        int[] indices = new int[nonZeros];
+        double[] values = new double[nonZeros];
+        for (int c = 0, k = 0; c < inputs.size(); c++) {
+            double v = inputs.get(c);
+            if (v != 0.0) {
+                indices[k] = c;
+                values[k] = v;
+                k++;
+            }
+        }
+        if (!measure || nonZeros == 0) {
+            return layer.activateSparse(indices, values);
+        }
+
+        // Untimed first, so that the layer's transposed weights are built outside the measurement
+        List<Double> outputs = layer.activateLayer(inputs);
+        layer.activateSparse(indices, values);
+        long dense = Long.MAX_VALUE;
+        long sparse = Long.MAX_VALUE;
+        for (int rep = 0; rep < MEASURE_REPEATS; rep++) {
+            long start = System.nanoTime();
+            layer.activateLayer(inputs);
+            dense = Math.min(dense, System.nanoTime() - start);
+            start = System.nanoTime();
+            layer.activateSparse(indices, values);
+            sparse = Math.min(sparse, System.nanoTime() - start);
+        }
+        record(dense, (double) sparse / nonZeros, inputs.size());
+        return outputs;
+    }
+
+    /**
+     * @brief Counts an input containing zeros and decides whether it is measured
+     * @return True if both kernels should be timed on this input
+     */
+    private synchronized boolean countSparseCall() {
+        long call = sparseCalls++;
+        return call >= WARMUP_CALLS && (call - WARMUP_CALLS) % RETUNE_INTERVAL == 0;
+    }
+
+    /**
+     * @brief Get the current break-even input density
+     * @return Density below which the sparse kernel is used
+     */
+    public double getThreshold() {
+        return threshold;
+    }
+
+    /**
+     * @brief Folds one timing measurement into the smoothed costs and recomputes the threshold
+     * @param dense Dense kernel time in nanoseconds
+     * @param sparsePerNonZero Sparse kernel time per non-zero input in nanoseconds
+     * @param width Number of inputs to the layer
+     */
+    private synchronized void record(double dense, double sparsePerNonZero, int width) {
+        if (denseNanos < 0.0) {
+            denseNanos = dense;
+            sparseNanosPerNonZero = sparsePerNonZero;
+        } else {
+            denseNanos += SMOOTHING * (dense - denseNanos);
+            sparseNanosPerNonZero += SMOOTHING * (sparsePerNonZero - sparseNanosPerNonZero);
+        }
+        if (sparseNanosPerNonZero > 0.0) {
+            threshold = Math.max(0.0, Math.min(1.0, denseNanos / (sparseNanosPerNonZero * width)));
+        }
+    }
+}
+
+/**
+ * @brief Fused log-softmax and cross-entropy loss over a vector of logits
+ *
+ * For the loss alone, the log-sum-exp is found in a single streaming pass
+ * that keeps a running maximum and rescales the running sum whenever the
+ * maximum grows. With the gradient, the maximum is found first and each
+ * e^(x - max) is written straight into the gradient while summing, so every
+ * logit is exponentiated once in branch-free loops, then scaled in place.
+ */
+class SoftmaxCrossEntropy {
+    /**
+     * @brief Computes the numerically stable log(sum(e^logits))
+     * @param logits Unnormalised class scores
+     * @return Log-sum-exp of the logits
+     */
+    public static double logSumExp(double[] logits) {
+        double max = Double.NEGATIVE_INFINITY;
+        double sum = 0.0;
+        for (double x : logits) {
+            if (x > max) {
+                sum = sum * Math.exp(max - x) + 1.0;
+                max = x;
+            } else {
+                sum += Math.exp(x - max);
+            }
+        }
+        return max + Math.log(sum);
+    }
+
+    /**
+     * @brief Computes the cross-entropy of softmax(logits) against a class label
+     * @param logits Unnormalised class scores
+     * @param label Index of the correct class
+     * @return -log(softmax(logits)[label])
+     */
+    public static double loss(double[] logits, int label) {
+        if (label < 0 || label >= logits.length) {
+            throw new IllegalArgumentException("Class label out of range: " + label);
+        }
+        return logSumExp(logits) - logits[label];
+    }
+
+    /**
+     * @brief Computes the loss and its gradient with respect to the logits
+     * @param logits Unnormalised class scores
+     * @param label Index of the correct class
+     * @param gradients Output: softmax(logits) - onehot(label)
+     * @return -log(softmax(logits)[label])
+     */
+    public static double lossAndGradient(double[] logits, int label, double[] gradients) {
+        if (label < 0 || label >= logits.length) {
+            throw new IllegalArgumentException("Class label out of range: " + label);
+        }
+        if (gradients.length != logits.length) {
+            throw new IllegalArgumentException("Gradient buffer must have one value per logit");
+        }
+        double max = Double.NEGATIVE_INFINITY;
+        for (double x : logits) {
+            max = Math.max(max, x);
+        }
+        double sum = 0.0;
+        for (int i = 0; i < logits.length; i++) {
+            double e = Math.exp(logits[i] - max);
+            gradients[i] = e;
+            sum += e;
+        }
+        double inverse = 1.0 / sum;
+        for (int i = 0; i < gradients.length; i++) {
+            gradients[i] *= inverse;
+        }
+        gradients[label] -= 1.0;
+        return max + Math.log(sum) - logits[label];
+    }
+}
+
+/**
+ * @brief Per-feature affine transform y = x * scale + shift
+ *
+ * Represents input standardisation as well as inference-mode batch
+ * normalisation, both of which can be folded into an adjacent dense layer.
+ */
+class Normalizer {
+    /** Multiplier of each feature */
+    private final double[] scale;
+    /** Offset added to each feature after scaling */
+    private final double[] shift;
+
+    /**
+     * @brief Constructs a transform from explicit scales and shifts
+     * @param scale Multiplier of each feature
+     * @param shift Offset of each feature
+     */
+    public Normalizer(double[] scale, double[] shift) {
+        if (scale.length != shift.length) {
+            throw new IllegalArgumentException("Scale and shift must have the same length");
+        }
+        this.scale = scale.clone();
+        this.shift = shift.clone();
+    }
+
+    /**
+     * @brief Creates a standardiser mapping each feature to zero mean and unit variance
+     * @param mean Mean of each feature
+     * @param variance Variance of each feature
+     * @param epsilon Added to the variance to avoid division by zero
+     * @return Transform (x - mean) / sqrt(variance + epsilon)
+     */
+    public static Normalizer standardize(double[] mean, double[] variance, double epsilon) {
+        double[] ones = new double[mean.length];
+        Arrays.fill(ones, 1.0);
+        return batchNorm(mean, variance, ones, new double[mean.length], epsilon);
+    }
+
+    /**
+     * @brief Creates the inference-mode transform of a batch normalisation layer
+     * @param mean Running mean of each feature
+     * @param variance Running variance of each feature
+     * @param gamma Learned scale of each feature
+     * @param beta Learned offset of each feature
+     * @param epsilon Added to the variance to avoid division by zero
+     * @return Transform gamma * (x - mean) / sqrt(variance + epsilon) + beta
+     */
+    public static Normalizer batchNorm(double[] mean, double[] variance, double[] gamma, double[] beta, double epsilon) {
+        double[] scale = new double[mean.length];
+        double[] shift = new double[mean.length];
+        for (int i = 0; i < mean.length; i++) {
+            scale[i] = gamma[i] / Math.sqrt(variance[i] + epsilon);
+            shift[i] = beta[i] - mean[i] * scale[i];
+        }
+        return new Normalizer(scale, shift);
+    }
+
+    /**
+     * @brief Applies the transform to a vector
+     * @param values Input values
+     * @return Transformed values
+     */
+    public List<Double> apply(List<Double> values) {
+        if (values.size() != scale.length) {
+            throw new IllegalArgumentException("Input size must match normalizer size");
+        }
+        List<Double> out = new ArrayList<>(scale.length);
+        for (int i = 0; i < scale.length; i++) {
+            out.add(values.get(i) * scale[i] + shift[i]);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Get the multiplier of each feature
+     * @return Scales
+     */
+    public double[] getScale() {
+        return scale;
+    }
+
+    /**
+     * @brief Get the offset of each feature
+     * @return Shifts
+     */
+    public double[] getShift() {
+        return shift;
+    }
+
+    /**
+     * @brief Get the number of features
+     * @return Feature count
+     */
+    public int size() {
+        return scale.length;
+    }
+}
+
+/**
+ * @brief Mergeable streaming quantile sketch with bounded memory
+ *
+ * Values enter level 0. When a level holds CAPACITY values it is sorted and
+ * every other value, starting at an alternating offset, is promoted to the
+ * next level, where each value stands for twice as many inputs. Memory grows
+ * only with the logarithm of the stream length, and two sketches merge by
+ * feeding one's levels into the other's.
+ */
+class QuantileSketch {
+    /** Values held per level before it is compacted */
+    static final int CAPACITY = 128;
+
+    /** Values held at each level; a value at level l has weight 2^l */
+    private double[][] levels = new double[1][CAPACITY];
+    /** Number of values held at each level */
+    private int[] sizes = new int[1];
+    /** Offset of the next compaction, alternated to keep the sketch unbiased */
+    private int offset;
+
+    /**
+     * @brief Adds one value to the sketch
+     * @param value Value to add
+     */
+    public void add(double value) {
+        insert(0, value);
+    }
+
+    /**
+     * @brief Adds every value summarised by another sketch
+     * @param other Sketch to merge in; left unchanged
+     */
+    public void merge(QuantileSketch other) {
+        for (int level = 0; level < other.sizes.length; level++) {
+            for (int i = 0; i < other.sizes[level]; i++) {
+                insert(level, other.levels[level][i]);
+            }
+        }
+    }
+
+    /**
+     * @brief Estimates the value below which the given fraction of the stream falls
+     * @param q Quantile, between 0 and 1
+     * @return Estimated quantile, or NaN for an empty sketch
+     */
+    public double quantile(double q) {
+        int total = 0;
+        for (int size : sizes) {
+            total += size;
+        }
+        if (total == 0) {
+            return Double.NaN;
+        }
+        double[][] weighted = new double[total][];
+        double totalWeight = 0.0;
+        int k = 0;
+        for (int level = 0; level < sizes.length; level++) {
+            double weight = Math.scalb(1.0, level);
+            for (int i = 0; i < sizes[level]; i++) {
+                weighted[k++] = new double[] {levels[level][i], weight};
+                totalWeight += weight;
+            }
+        }
+        Arrays.sort(weighted, (a, b) -> Double.compare(a[0], b[0]));
+
+        double target = q * totalWeight;
+        double cumulative = 0.0;
+        for (double[] entry : weighted) {
+            cumulative += entry[1];
+            if (cumulative >= target) {
+                return entry[0];
+            }
+        }
+        return weighted[total - 1][0];
+    }
+
+    /**
+     * @brief Stores a value at a level, compacting the level first if it is full
+     * @param level Level of the value
+     * @param value Value to store
+     */
+    private void insert(int level, double value) {
+        if (level >= sizes.length) {
+            levels = Arrays.copyOf(levels, level + 1);
+            sizes = Arrays.copyOf(sizes, level + 1);
+            for (int l = 0; l <= level; l++) {
+                if (levels[l] == null) {
+                    levels[l] = new double[CAPACITY];
+                }
+            }
+        }
+        if (sizes[level] == CAPACITY) {
+            double[] full = levels[level];
+            Arrays.sort(full);
+            sizes[level] = 0;
+            levels[level] = new double[CAPACITY];
+            for (int i = offset; i < CAPACITY; i += 2) {
+                insert(level + 1, full[i]);
+            }
+            offset ^= 1;
+        }
+        levels[level][sizes[level]++] = value;
+    }
+}
+
+/**
+ * @brief Per-feature statistics gathered in a single pass over a data set
+ *
+ * Mean and variance use Welford's update, and partial results from different
+ * threads are combined with Chan's parallel formula, so a parallel stream
+ * over the rows is read exactly once. Min, max and a quantile sketch are
+ * kept alongside.
+ */
+class FeatureStatistics {
+    /** Number of features per row */
+    private final int features;
+    /** Number of rows seen */
+    private long count;
+    /** Running mean of each feature */
+    private final double[] mean;
+    /** Running sum of squared deviations from the mean of each feature */
+    private final double[] m2;
+    /** Smallest value of each feature */
+    private final double[] min;
+    /** Largest value of each feature */
+    private final double[] max;
+    /** Quantile sketch of each feature */
+    private final QuantileSketch[] sketches;
+
+    /**
+     * @brief Constructs empty statistics
+     * @param features Number of features per row
+     */
+    public FeatureStatistics(int features) {
+        this.features = features;
+        mean = new double[features];
+        m2 = new double[features];
+        min = new double[features];
+        max = new double[features];
+        Arrays.fill(min, Double.POSITIVE_INFINITY);
+        Arrays.fill(max, Double.NEGATIVE_INFINITY);
+        sketches = new QuantileSketch[features];
+        for (int i = 0; i < features; i++) {
+            sketches[i] = new QuantileSketch();
+        }
+    }
+
+    /**
+     * @brief Gathers statistics over a stream of rows, in parallel
+     * @param rows Rows of the data set
+     * @param features Number of features per row
+     * @return Statistics of all rows
+     */
+    public static FeatureStatistics collect(Stream<List<Double>> rows, int features) {
+        return rows.parallel().collect(
+                () -> new FeatureStatistics(features),
+                (stats, row) -> stats.add(row),
+                (stats, other) -> stats.merge(other));
+    }
+
+    /**
+     * @brief Gathers statistics over a comma-separated file with one row per line, in parallel
+     * @param filename Name of the file to read
+     * @param features Number of features per row
+     * @return Statistics of all rows
+     * @throws IOException If the file cannot be read
+     */
+    public static FeatureStatistics fromCsv(String filename, int features) throws IOException {
+        try (Stream<String> lines = Files.lines(Paths.get(filename))) {
+            return lines.parallel()
+                    .filter(line -> !line.trim().isEmpty())
+                    .collect(
+                            () -> new FeatureStatistics(features),
+                            (stats, line) -> stats.add(parseRow(line, features)),
+                            (stats, other) -> stats.merge(other));
+        }
+    }
+
+    /**
+     * @brief Adds one row with Welford's update
+     * @param row Feature values
+     */
+    public void add(List<Double> row) {
+        add(Utils.toArray(row));
+    }
+
+    /**
+     * @brief Adds one row with Welford's update
+     * @param row Feature values
+     */
+    public void add(double[] row) {
+        if (row.length != features) {
+            throw new IllegalArgumentException("Row size must match number of features");
+        }
+        count++;
+        for (int i = 0; i < features; i++) {
+            double x = row[i];
+            double delta = x - mean[i];
+            mean[i] += delta / count;
+            m2[i] += delta * (x - mean[i]);
+            min[i] = Math.min(min[i], x);
+            max[i] = Math.max(max[i], x);
+            sketches[i].add(x);
+        }
+    }
+
+    /**
+     * @brief Combines statistics gathered over another part of the data set
+     * @param other Partial statistics; left unchanged
+     */
+    public void merge(FeatureStatistics other) {
+        if (other.features != features) {
+            throw new IllegalArgumentException("Statistics must have the same number of features");
+        }
+        if (other.count == 0) {
+            return;
+        }
+        long total = count + other.count;
+        for (int i = 0; i < features; i++) {
+            double delta = other.mean[i] - mean[i];
+            mean[i] += delta * other.count / total;
+            m2[i] += other.m2[i] + delta * delta * ((double) count * other.count / total);
+            min[i] = Math.min(min[i], other.min[i]);
+            max[i] = Math.max(max[i], other.max[i]);
+            sketches[i].merge(other.sketches[i]);
+        }
+        count = total;
+    }
+
+    /**
+     * @brief Creates a standardiser from the gathered mean and variance
+     * @param epsilon Added to the variance to avoid division by zero
+     * @return Normalizer mapping each feature to zero mean and unit variance
+     */
+    public Normalizer toNormalizer(double epsilon) {
+        return Normalizer.standardize(mean, getVariance(), epsilon);
+    }
+
+    /**
+     * @brief Get the number of rows seen
+     * @return Row count
+     */
+    public long getCount() {
+        return count;
+    }
+
+    /**
+     * @brief Get the mean of each feature
+     * @return Means
+     */
+    public double[] getMean() {
+        return mean.clone();
+    }
+
+    /**
+     * @brief Get the population variance of each feature
+     * @return Variances
+     */
+    public double[] getVariance() {
+        double[] variance = new double[features];
+        for (int i = 0; i < features; i++) {
+            variance[i] = count > 0 ? m2[i] / count : 0.0;
+        }
+        return variance;
+    }
+
+    /**
+     * @brief Get the smallest value of each feature
+     * @return Minimums
+     */
+    public double[] getMin() {
+        return min.clone();
+    }
+
+    /**
+     * @brief Get the largest value of each feature
+     * @return Maximums
+     */
+    public double[] getMax() {
+        return max.clone();
+    }
+
+    /**
+     * @brief Estimates a quantile of one feature
+     * @param feature Feature index
+     * @param q Quantile, between 0 and 1
+     * @return Estimated quantile
+     */
+    public double getQuantile(int feature, double q) {
+        return sketches[feature].quantile(q);
+    }
+
+    /**
+     * @brief Parses one comma-separated row
+     * @param line Text of the row
+     * @param features Expected number of values
+     * @return Parsed values
+     */
+    private static double[] parseRow(String line, int features) {
+        String[] fields = line.split(",");
+        if (fields.length != features) {
+            throw new IllegalArgumentException("Row size must match number of features: " + line);
+        }
+        double[] row = new double[features];
+        for (int i = 0; i < features; i++) {
+            row[i] = Double.parseDouble(fields[i].trim());
+        }
+        return row;
+    }
+}
+
+/**
+ * @brief Layer applying a Normalizer, e.g. batch normalisation at inference time
+ *
+ * It costs an extra pass over its input; NeuralNetworkImpl.foldNormalization()
+ * removes it by folding the transform into a neighbouring dense layer.
+ */
+class NormalizationLayer extends Layer {
+    /** Transform applied to the input */
+    private final Normalizer normalizer;
+
+    /**
+     * @brief Constructs a layer applying the given transform
+     * @param normalizer Transform to apply
+     */
+    public NormalizationLayer(Normalizer normalizer) {
+        this.normalizer = normalizer;
+        setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Applies the transform followed by the layer's activation
+     * @param inputs List of input values to the layer
+     * @return List of transformed values
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != normalizer.size()) {
+            throw new IllegalArgumentException("Input size must match normalizer size");
+        }
+        double[] x = Utils.toArray(inputs);
+        double[] scale = normalizer.getScale();
+        for (int i = 0; i < x.length; i++) {
+            x[i] *= scale[i];
+        }
+        getActivation().apply(x, normalizer.getShift(), x);
+        return Utils.toList(x);
+    }
+
+    /**
+     * @brief Get the transform applied by this layer
+     * @return Normalizer
+     */
+    public Normalizer getNormalizer() {
+        return normalizer;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return normalizer.size();
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return normalizer.size();
+    }
+}
+
+/**
+ * @brief Layer normalisation with a learned per-feature scale and offset
+ *
+ * The mean and variance of the input vector are found in one Welford pass,
+ * and the normalisation, the affine transform and the activation are applied
+ * together in a second. Backward likewise needs one pass for the two
+ * reductions and one to write the input gradients.
+ */
+class LayerNormLayer extends Layer {
+    /** Added to the variance to avoid division by zero */
+    private final double epsilon;
+    /** Learned scale of each feature */
+    private final double[] gamma;
+    /** Learned offset of each feature */
+    private final double[] beta;
+    /** Accumulated gradients of gamma */
+    private final double[] gammaGradients;
+    /** Accumulated gradients of beta */
+    private final double[] betaGradients;
+
+    /**
+     * @brief Constructs a layer with unit scale and zero offset
+     * @param size Number of features
+     * @param epsilon Added to the variance to avoid division by zero
+     */
+    public LayerNormLayer(int size, double epsilon) {
+        this.epsilon = epsilon;
+        gamma = new double[size];
+        Arrays.fill(gamma, 1.0);
+        beta = new double[size];
+        gammaGradients = new double[size];
+        betaGradients = new double[size];
+        setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Constructs an independent copy of another layer-norm layer, without its pending gradients
+     * @param other Layer to copy
+     */
+    public LayerNormLayer(LayerNormLayer other) {
+        epsilon = other.epsilon;
+        gamma = other.gamma.clone();
+        beta = other.beta.clone();
+        gammaGradients = new double[gamma.length];
+        betaGradients = new double[gamma.length];
+        setActivation(other.getActivation());
+    }
+
+    /**
+     * @brief Normalises the input and applies the affine transform and activation
+     * @param inputs List of input values to the layer
+     * @return List of normalised values
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        double[] x = Utils.toArray(inputs);
+        double[] stats = statistics(x);
+        double mean = stats[0];
+        double invStd = stats[1];
+
+        if (getActivation() == Activation.IDENTITY) {
+            for (int i = 0; i < x.length; i++) {
+                x[i] = (x[i] - mean) * invStd * gamma[i] + beta[i];
+            }
+        } else {
+            for (int i = 0; i < x.length; i++) {
+                x[i] = (x[i] - mean) * invStd * gamma[i];
+            }
+            getActivation().apply(x, beta, x);
+        }
+        return Utils.toList(x);
+    }
+
+    /**
+     * @brief Back-propagates through the normalisation and accumulates gamma and beta gradients
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        double[] x = Utils.toArray(inputs);
+        int n = x.length;
+        double[] stats = statistics(x);
+        double mean = stats[0];
+        double invStd = stats[1];
+
+        double[] normalized = new double[n];
+        for (int i = 0; i < n; i++) {
+            normalized[i] = (x[i] - mean) * invStd;
+        }
+        double[] preActivations = null;
+        if (getActivation().needsPreActivation()) {
+            preActivations = new double[n];
+            for (int i = 0; i < n; i++) {
+                preActivations[i] = normalized[i] * gamma[i] + beta[i];
+            }
+        }
+        double[] g = getActivation().gradient(preActivations, Utils.toArray(outputs), Utils.toArray(outputGradients));
+
+        double sum = 0.0;
+        double dot = 0.0;
+        for (int i = 0; i < n; i++) {
+            gammaGradients[i] += g[i] * normalized[i];
+            betaGradients[i] += g[i];
+            g[i] *= gamma[i];
+            sum += g[i];
+            dot += g[i] * normalized[i];
+        }
+        double meanG = sum / n;
+        double meanGx = dot / n;
+        for (int i = 0; i < n; i++) {
+            g[i] = invStd * (g[i] - meanG - normalized[i] * meanGx);
+        }
+        return Utils.toList(g);
+    }
+
+    /**
+     * @brief Takes a gradient descent step on gamma and beta and clears their gradients
+     * @param learningRate Step size
+     */
+    @Override
+    public void applyGradients(double learningRate) {
+        for (int i = 0; i < gamma.length; i++) {
+            gamma[i] -= learningRate * gammaGradients[i];
+            beta[i] -= learningRate * betaGradients[i];
+        }
+        Arrays.fill(gammaGradients, 0.0);
+        Arrays.fill(betaGradients, 0.0);
+    }
+
+    /**
+     * @brief Clears the gamma and beta gradients without updating them
+     */
+    @Override
+    public void discardGradients() {
+        Arrays.fill(gammaGradients, 0.0);
+        Arrays.fill(betaGradients, 0.0);
+    }
+
+    /**
+     * @brief Get the learned scale of each feature
+     * @return Gamma, shared with the layer
+     */
+    public double[] getGamma() {
+        return gamma;
+    }
+
+    /**
+     * @brief Get the learned offset of each feature
+     * @return Beta, shared with the layer
+     */
+    public double[] getBeta() {
+        return beta;
+    }
+
+    /**
+     * @brief Get the accumulated gradients of gamma
+     * @return Gamma gradients, shared with the layer
+     */
+    public double[] getGammaGradients() {
+        return gammaGradients;
+    }
+
+    /**
+     * @brief Get the accumulated gradients of beta
+     * @return Beta gradients, shared with the layer
+     */
+    public double[] getBetaGradients() {
+        return betaGradients;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return gamma.length;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return gamma.length;
+    }
+
+    /**
+     * @brief Computes the mean and inverse standard deviation in one Welford pass
+     * @param x Input values
+     * @return {mean, 1 / sqrt(variance + epsilon)}
+     */
+    private double[] statistics(double[] x) {
+        if (x.length != gamma.length) {
+            throw new IllegalArgumentException("Input size must match layer norm size");
+        }
+        double mean = 0.0;
+        double m2 = 0.0;
+        for (int i = 0; i < x.length; i++) {
+            double delta = x[i] - mean;
+            mean += delta / (i + 1);
+            m2 += delta * (x[i] - mean);
+        }
+        return new double[] {mean, 1.0 / Math.sqrt(m2 / x.length + epsilon)};
+    }
+}
+
+/**
+ * @brief 2D convolution over NHWC tensors, lowered to im2col and the tiled matrix multiply
+ *
+ * Each output position becomes one row of a (positions x kernelH*kernelW*C)
+ * patch matrix, and multiplying it by the (kernelH*kernelW*C x filters)
+ * weight matrix produces the output directly in NHWC order. A 1D convolution
+ * is the special case of height 1, see conv1d().
+ */
+class Conv2DLayer extends Layer {
+    /** Input height */
+    private final int height;
+    /** Input width */
+    private final int width;
+    /** Input channels */
+    private final int channels;
+    /** Number of filters, i.e. output channels */
+    private final int filters;
+    /** Kernel height */
+    private final int kernelHeight;
+    /** Kernel width */
+    private final int kernelWidth;
+    /** Step between neighbouring output positions */
+    private final int stride;
+    /** Zero padding added on every side */
+    private final int padding;
+    /** Output height */
+    private final int outHeight;
+    /** Output width */
+    private final int outWidth;
+    /** Row-major (kernelHeight*kernelWidth*channels x filters) weights */
+    private final double[] weights;
+    /** Bias of each filter */
+    private final double[] biases;
+    /** Accumulated weight gradients followed by one bias gradient per filter, allocated on first backward */
+    private double[] gradients;
+
+    /**
+     * @brief Constructs a convolution with random weights and zero biases
+     * @param height Input height
+     * @param width Input width
+     * @param channels Input channels
+     * @param filters Number of output channels
+     * @param kernelHeight Kernel height
+     * @param kernelWidth Kernel width
+     * @param stride Step between output positions
+     * @param padding Zero padding on every side
+     */
+    public Conv2DLayer(int height, int width, int channels, int filters,
+                       int kernelHeight, int kernelWidth, int stride, int padding) {
+        if (stride < 1 || kernelHeight > height + 2 * padding || kernelWidth > width + 2 * padding) {
+            throw new IllegalArgumentException("Kernel must fit in the padded input and stride must be positive");
+        }
+        this.height = height;
+        this.width = width;
+        this.channels = channels;
+        this.filters = filters;
+        this.kernelHeight = kernelHeight;
+        this.kernelWidth = kernelWidth;
+        this.stride = stride;
+        this.padding = padding;
+        outHeight = (height + 2 * padding - kernelHeight) / stride + 1;
+        outWidth = (width + 2 * padding - kernelWidth) / stride + 1;
+
+        int patch = kernelHeight * kernelWidth * channels;
+        weights = new double[patch * filters];
+        biases = new double[filters];
+        Random rand = new Random();
+        double scale = 1.0 / Math.sqrt(patch);
+        for (int i = 0; i < weights.length; i++) {
+            weights[i] = rand.nextGaussian() * scale;
+        }
+    }
+
+    /**
+     * @brief Constructs an independent copy of another convolution, without its pending gradients
+     * @param other Convolution to copy
+     */
+    public Conv2DLayer(Conv2DLayer other) {
+        height = other.height;
+        width = other.width;
+        channels = other.channels;
+        filters = other.filters;
+        kernelHeight = other.kernelHeight;
+        kernelWidth = other.kernelWidth;
+        stride = other.stride;
+        padding = other.padding;
+        outHeight = other.outHeight;
+        outWidth = other.outWidth;
+        weights = other.weights.clone();
+        biases = other.biases.clone();
+        setActivation(other.getActivation());
+    }
+
+    /**
+     * @brief Constructs a 1D convolution over (length x channels) inputs
+     * @param length Input length
+     * @param channels Input channels
+     * @param filters Number of output channels
+     * @param kernel Kernel length
+     * @param stride Step between output positions
+     * @param padding Zero padding at both ends
+     * @return Convolution of height 1
+     */
+    public static Conv2DLayer conv1d(int length, int channels, int filters, int kernel, int stride, int padding) {
+        return new Conv2DLayer(1, length, channels, filters, 1, kernel, stride, padding);
+    }
+
+    /**
+     * @brief Convolves a batch of NHWC inputs
+     * @param input Batch of inputs, batch x height x width x channels
+     * @param batch Number of samples in the batch
+     * @return Batch of outputs, batch x outHeight x outWidth x filters
+     */
+    public double[] forward(double[] input, int batch) {
+        if (input.length != batch * getInputSize()) {
+            throw new IllegalArgumentException("Input size must match batch size times layer input size");
+        }
+        int rows = batch * outHeight * outWidth;
+        int patch = kernelHeight * kernelWidth * channels;
+        double[] out = MatrixOps.multiply(im2col(input, batch), weights, rows, patch, filters);
+
+        double[] row = new double[filters];
+        for (int r = 0; r < rows; r++) {
+            System.arraycopy(out, r * filters, row, 0, filters);
+            getActivation().apply(row, biases, row);
+            System.arraycopy(row, 0, out, r * filters, filters);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Convolves a single NHWC input
+     * @param inputs Flattened height x width x channels input
+     * @return Flattened outHeight x outWidth x filters output
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        return Utils.toList(forward(Utils.toArray(inputs), 1));
+    }
+
+    /**
+     * @brief Back-propagates a single sample and accumulates weight and bias gradients
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        int rows = outHeight * outWidth;
+        int patch = kernelHeight * kernelWidth * channels;
+        if (gradients == null) {
+            gradients = new double[weights.length + filters];
+        }
+        double[] cols = im2col(Utils.toArray(inputs), 1);
+
+        double[] preActivations = null;
+        if (getActivation().needsPreActivation()) {
+            preActivations = MatrixOps.multiply(cols, weights, rows, patch, filters);
+            for (int r = 0; r < rows; r++) {
+                for (int f = 0; f < filters; f++) {
+                    preActivations[r * filters + f] += biases[f];
+                }
+            }
+        }
+        double[] y = Utils.toArray(outputs);
+        double[] g = Utils.toArray(outputGradients);
+        double[] delta = new double[rows * filters];
+        double[] rowPre = new double[filters];
+        double[] rowY = new double[filters];
+        double[] rowG = new double[filters];
+        for (int r = 0; r < rows; r++) {
+            if (preActivations != null) {
+                System.arraycopy(preActivations, r * filters, rowPre, 0, filters);
+            }
+            System.arraycopy(y, r * filters, rowY, 0, filters);
+            System.arraycopy(g, r * filters, rowG, 0, filters);
+            double[] rowDelta = getActivation().gradient(rowPre, rowY, rowG);
+            System.arraycopy(rowDelta, 0, delta, r * filters, filters);
+            for (int f = 0; f < filters; f++) {
+                gradients[weights.length + f] += rowDelta[f];
+            }
+        }
+
+        double[] dw = MatrixOps.multiply(MatrixOps.transpose(cols, rows, patch), delta, patch, rows, filters);
+        for (int i = 0; i < dw.length; i++) {
+            gradients[i] += dw[i];
+        }
+        double[] dcols = MatrixOps.multiply(delta, MatrixOps.transpose(weights, patch, filters), rows, filters, patch);
+        return Utils.toList(col2im(dcols));
+    }
+
+    /**
+     * @brief Takes a gradient descent step with the accumulated gradients and clears them
+     * @param learningRate Step size
+     */
+    @Override
+    public void applyGradients(double learningRate) {
+        if (gradients == null) {
+            return;
+        }
+        for (int i = 0; i < weights.length; i++) {
+            weights[i] -= learningRate * gradients[i];
+        }
+        for (int f = 0; f < filters; f++) {
+            biases[f] -= learningRate * gradients[weights.length + f];
+        }
+        Arrays.fill(gradients, 0.0);
+    }
+
+    /**
+     * @brief Clears the accumulated gradients without updating the filters
+     */
+    @Override
+    public void discardGradients() {
+        if (gradients != null) {
+            Arrays.fill(gradients, 0.0);
+        }
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return height * width * channels
+     */
+    @Override
+    public int getInputSize() {
+        return height * width * channels;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return outHeight * outWidth * filters
+     */
+    @Override
+    public int getOutputSize() {
+        return outHeight * outWidth * filters;
+    }
+
+    /**
+     * @brief Get the filter weights
+     * @return Row-major (kernelHeight*kernelWidth*channels x filters) weights, shared with the layer
+     */
+    public double[] getWeights() {
+        return weights;
+    }
+
+    /**
+     * @brief Get the bias of each filter
+     * @return Biases, shared with the layer
+     */
+    public double[] getBiases() {
+        return biases;
+    }
+
+    /**
+     * @brief Get the accumulated gradients
+     * @return Weight gradients followed by one bias gradient per filter, or null before the first backward
+     */
+    public double[] getGradients() {
+        return gradients;
+    }
+
+    /**
+     * @brief Gathers every receptive field of a batch into one row of a patch matrix
+     * @param input Batch of NHWC inputs
+     * @param batch Number of samples
+     * @return Row-major (batch*outHeight*outWidth x kernelHeight*kernelWidth*channels) matrix
+     */
+    private double[] im2col(double[] input, int batch) {
+        int patch = kernelHeight * kernelWidth * channels;
+        double[] cols = new double[batch * outHeight * outWidth * patch];
+        for (int n = 0; n < batch; n++) {
+            for (int oh = 0; oh < outHeight; oh++) {
+                for (int ow = 0; ow < outWidth; ow++) {
+                    int rowBase = ((n * outHeight + oh) * outWidth + ow) * patch;
+                    for (int kh = 0; kh < kernelHeight; kh++) {
+                        int ih = oh * stride - padding + kh;
+                        if (ih < 0 || ih >= height) {
+                            continue;
+                        }
+                        for (int kw = 0; kw < kernelWidth; kw++) {
+                            int iw = ow * stride - padding + kw;
+                            if (iw < 0 || iw >= width) {
+                                continue;
+                            }
+                            // Channels are contiguous in NHWC, so each tap is one block copy
+                            System.arraycopy(input, ((n * height + ih) * width + iw) * channels,
+                                    cols, rowBase + (kh * kernelWidth + kw) * channels, channels);
+                        }
+                    }
+                }
+            }
+        }
+        return cols;
+    }
+
+    /**
+     * @brief Scatters patch-matrix gradients of one sample back onto the input, summing overlaps
+     * @param cols Row-major (outHeight*outWidth x kernelHeight*kernelWidth*channels) gradients
+     * @return Gradient of each input value, height x width x channels
+     */
+    private double[] col2im(double[] cols) {
+        int patch = kernelHeight * kernelWidth * channels;
+        double[] input = new double[getInputSize()];
+        for (int oh = 0; oh < outHeight; oh++) {
+            for (int ow = 0; ow < outWidth; ow++) {
+                int rowBase = (oh * outWidth + ow) * patch;
+                for (int kh = 0; kh < kernelHeight; kh++) {
+                    int ih = oh * stride - padding + kh;
+                    if (ih < 0 || ih >= height) {
+                        continue;
+                    }
+                    for (int kw = 0; kw < kernelWidth; kw++) {
+                        int iw = ow * stride - padding + kw;
+                        if (iw < 0 || iw >= width) {
+                            continue;
+                        }
+                        int in = (ih * width + iw) * channels;
+                        int col = rowBase + (kh * kernelWidth + kw) * channels;
+                        for (int c = 0; c < channels; c++) {
+                            input[in + c] += cols[col + c];
+                        }
+                    }
+                }
+            }
+        }
+        return input;
+    }
+}
+
+/**
+ * @brief Max or average pooling over NHWC tensors; 1D pooling is the case of height 1
+ */
+class PoolingLayer extends Layer {
+    /** Input height */
+    private final int height;
+    /** Input width */
+    private final int width;
+    /** Input and output channels */
+    private final int channels;
+    /** Pooling window height */
+    private final int poolHeight;
+    /** Pooling window width */
+    private final int poolWidth;
+    /** Step between neighbouring windows */
+    private final int stride;
+    /** Whether to take the maximum rather than the average of each window */
+    private final boolean max;
+    /** Output height */
+    private final int outHeight;
+    /** Output width */
+    private final int outWidth;
+
+    /**
+     * @brief Constructs a pooling layer without padding
+     * @param height Input height
+     * @param width Input width
+     * @param channels Input channels
+     * @param poolHeight Window height
+     * @param poolWidth Window width
+     * @param stride Step between windows
+     * @param max Whether to use max pooling instead of average pooling
+     */
+    public PoolingLayer(int height, int width, int channels, int poolHeight, int poolWidth, int stride, boolean max) {
+        if (stride < 1 || poolHeight > height || poolWidth > width) {
+            throw new IllegalArgumentException("Pooling window must fit in the input and stride must be positive");
+        }
+        this.height = height;
+        this.width = width;
+        this.channels = channels;
+        this.poolHeight = poolHeight;
+        this.poolWidth = poolWidth;
+        this.stride = stride;
+        this.max = max;
+        outHeight = (height - poolHeight) / stride + 1;
+        outWidth = (width - poolWidth) / stride + 1;
+        setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Pools a batch of NHWC inputs
+     * @param input Batch of inputs, batch x height x width x channels
+     * @param batch Number of samples in the batch
+     * @return Batch of outputs, batch x outHeight x outWidth x channels
+     */
+    public double[] forward(double[] input, int batch) {
+        if (input.length != batch * getInputSize()) {
+            throw new IllegalArgumentException("Input size must match batch size times layer input size");
+        }
+        double[] out = new double[batch * getOutputSize()];
+        double[] window = new double[channels];
+        double inv = 1.0 / (poolHeight * poolWidth);
+        for (int n = 0; n < batch; n++) {
+            for (int oh = 0; oh < outHeight; oh++) {
+                for (int ow = 0; ow < outWidth; ow++) {
+                    Arrays.fill(window, max ? Double.NEGATIVE_INFINITY : 0.0);
+                    for (int kh = 0; kh < poolHeight; kh++) {
+                        for (int kw = 0; kw < poolWidth; kw++) {
+                            int in = ((n * height + oh * stride + kh) * width + ow * stride + kw) * channels;
+                            for (int c = 0; c < channels; c++) {
+                                window[c] = max ? Math.max(window[c], input[in + c]) : window[c] + input[in + c];
+                            }
+                        }
+                    }
+                    int o = ((n * outHeight + oh) * outWidth + ow) * channels;
+                    for (int c = 0; c < channels; c++) {
+                        out[o + c] = max ? window[c] : window[c] * inv;
+                    }
+                }
+            }
+        }
+        return out;
+    }
+
+    /**
+     * @brief Pools a single NHWC input
+     * @param inputs Flattened height x width x channels input
+     * @return Flattened outHeight x outWidth x channels output
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        return Utils.toList(forward(Utils.toArray(inputs), 1));
+    }
+
+    /**
+     * @brief Routes gradients to the maximum of each window, or spreads them evenly for average pooling
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        double[] x = Utils.toArray(inputs);
+        double[] y = Utils.toArray(outputs);
+        double[] g = Utils.toArray(outputGradients);
+        double[] dx = new double[x.length];
+        double inv = 1.0 / (poolHeight * poolWidth);
+        for (int oh = 0; oh < outHeight; oh++) {
+            for (int ow = 0; ow < outWidth; ow++) {
+                int o = (oh * outWidth + ow) * channels;
+                for (int c = 0; c < channels; c++) {
+                    boolean routed = false;
+                    for (int kh = 0; kh < poolHeight; kh++) {
+                        for (int kw = 0; kw < poolWidth; kw++) {
+                            int in = ((oh * stride + kh) * width + ow * stride + kw) * channels + c;
+                            if (!max) {
+                                dx[in] += g[o + c] * inv;
+                            } else if (!routed && x[in] == y[o + c]) {
+                                dx[in] += g[o + c];
+                                routed = true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return Utils.toList(dx);
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return height * width * channels
+     */
+    @Override
+    public int getInputSize() {
+        return height * width * channels;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return outHeight * outWidth * channels
+     */
+    @Override
+    public int getOutputSize() {
+        return outHeight * outWidth * channels;
+    }
+}
+
+/**
+ * @brief Base of recurrent layers that run every gate of a time step as one matrix product
+ *
+ * The weights of all gates are concatenated column-wise, so the input
+ * projections of every time step of every sequence in a batch are a single
+ * (batch*length x input) * (input x gates*hidden) product computed up front,
+ * and each time step needs one (batch x hidden) * (hidden x gates*hidden)
+ * product for the recurrent part. Sequences of equal length are bucketed
+ * together so a batch never carries padding.
+ */
+abstract class RecurrentLayer {
+    /** Width of each time step's input */
+    protected final int inputSize;
+    /** Width of the hidden state */
+    protected final int hiddenSize;
+    /** Number of gates whose weights are concatenated */
+    protected final int gates;
+    /** Row-major (inputSize x gates*hiddenSize) input weights */
+    protected final double[] inputWeights;
+    /** Row-major (hiddenSize x gates*hiddenSize) recurrent weights */
+    protected final double[] recurrentWeights;
+    /** Bias of each gate unit, added to the input projection */
+    protected final double[] biases;
+
+    /**
+     * @brief Constructs a layer with random weights and zero biases
+     * @param inputSize Width of each time step's input
+     * @param hiddenSize Width of the hidden state
+     * @param gates Number of gates
+     */
+    protected RecurrentLayer(int inputSize, int hiddenSize, int gates) {
+        this.inputSize = inputSize;
+        this.hiddenSize = hiddenSize;
+        this.gates = gates;
+        inputWeights = new double[inputSize * gates * hiddenSize];
+        recurrentWeights = new double[hiddenSize * gates * hiddenSize];
+        biases = new double[gates * hiddenSize];
+        Random rand = new Random();
+        double scale = 1.0 / Math.sqrt(hiddenSize);
+        for (int i = 0; i < inputWeights.length; i++) {
+            inputWeights[i] = rand.nextGaussian() * scale;
+        }
+        for (int i = 0; i < recurrentWeights.length; i++) {
+            recurrentWeights[i] = rand.nextGaussian() * scale;
+        }
+    }
+
+    /**
+     * @brief Runs sequences of any lengths, batching those of equal length together
+     * @param sequences Each sequence flattened as length x inputSize
+     * @return Final hidden state of each sequence, in input order
+     */
+    public List<double[]> forward(List<double[]> sequences) {
+        Map<Integer, List<Integer>> buckets = new TreeMap<>();
+        for (int s = 0; s < sequences.size(); s++) {
+            int values = sequences.get(s).length;
+            if (values % inputSize != 0) {
+                throw new IllegalArgumentException("Sequence size must be a multiple of the input size");
+            }
+            buckets.computeIfAbsent(values / inputSize, k -> new ArrayList<>()).add(s);
+        }
+
+        double[][] results = new double[sequences.size()][];
+        for (Map.Entry<Integer, List<Integer>> bucket : buckets.entrySet()) {
+            int length = bucket.getKey();
+            List<Integer> members = bucket.getValue();
+            double[] packed = new double[members.size() * length * inputSize];
+            for (int b = 0; b < members.size(); b++) {
+                System.arraycopy(sequences.get(members.get(b)), 0, packed, b * length * inputSize, length * inputSize);
+            }
+            double[] hidden = forwardBatch(packed, members.size(), length);
+            for (int b = 0; b < members.size(); b++) {
+                results[members.get(b)] = Arrays.copyOfRange(hidden, b * hiddenSize, (b + 1) * hiddenSize);
+            }
+        }
+        return Arrays.asList(results);
+    }
+
+    /**
+     * @brief Runs a batch of sequences of the same length
+     * @param sequences Row-major batch x length x inputSize values
+     * @param batch Number of sequences
+     * @param length Time steps per sequence
+     * @return Row-major batch x hiddenSize final hidden states
+     */
+    public double[] forwardBatch(double[] sequences, int batch, int length) {
+        if (sequences.length != batch * length * inputSize) {
+            throw new IllegalArgumentException("Input size must match batch x length x input size");
+        }
+        int width = gates * hiddenSize;
+        double[] projected = MatrixOps.multiply(sequences, inputWeights, batch * length, inputSize, width);
+        double[] hidden = new double[batch * hiddenSize];
+        double[] cell = new double[batch * hiddenSize];
+        for (int t = 0; t < length; t++) {
+            double[] recurrent = MatrixOps.multiply(hidden, recurrentWeights, batch, hiddenSize, width);
+            for (int b = 0; b < batch; b++) {
+                step(projected, ((b * length) + t) * width, recurrent, b * width, hidden, cell, b * hiddenSize);
+            }
+        }
+        return hidden;
+    }
+
+    /**
+     * @brief Get the width of the hidden state
+     * @return Hidden size
+     */
+    public int getHiddenSize() {
+        return hiddenSize;
+    }
+
+    /**
+     * @brief Advances one sequence by one time step, updating its state in place
+     * @param projected Input projections of all time steps, without bias
+     * @param projectedOffset Offset of this step's gates*hiddenSize projections
+     * @param recurrent Recurrent projections of the batch for this step
+     * @param recurrentOffset Offset of this sequence's gates*hiddenSize projections
+     * @param hidden Hidden states of the batch
+     * @param cell Cell states of the batch, for layers that have one
+     * @param stateOffset Offset of this sequence's state
+     */
+    protected abstract void step(double[] projected, int projectedOffset, double[] recurrent, int recurrentOffset,
+                                 double[] hidden, double[] cell, int stateOffset);
+}
+
+/**
+ * @brief Long short-term memory layer with gates ordered input, forget, candidate, output
+ */
+class LstmLayer extends RecurrentLayer {
+    /**
+     * @brief Constructs an LSTM with the forget gate bias initialised to 1
+     * @param inputSize Width of each time step's input
+     * @param hiddenSize Width of the hidden and cell states
+     */
+    public LstmLayer(int inputSize, int hiddenSize) {
+        super(inputSize, hiddenSize, 4);
+        Arrays.fill(biases, hiddenSize, 2 * hiddenSize, 1.0);
+    }
+
+    /**
+     * @brief c' = f * c + i * g, h' = o * tanh(c')
+     */
+    @Override
+    protected void step(double[] projected, int projectedOffset, double[] recurrent, int recurrentOffset,
+                        double[] hidden, double[] cell, int stateOffset) {
+        int h = hiddenSize;
+        for (int j = 0; j < h; j++) {
+            double i = Neuron.sigmoid(projected[projectedOffset + j] + recurrent[recurrentOffset + j] + biases[j]);
+            double f = Neuron.sigmoid(projected[projectedOffset + h + j] + recurrent[recurrentOffset + h + j] + biases[h + j]);
+            double g = Math.tanh(projected[projectedOffset + 2 * h + j] + recurrent[recurrentOffset + 2 * h + j] + biases[2 * h + j]);
+            double o = Neuron.sigmoid(projected[projectedOffset + 3 * h + j] + recurrent[recurrentOffset + 3 * h + j] + biases[3 * h + j]);
+            double c = f * cell[stateOffset + j] + i * g;
+            cell[stateOffset + j] = c;
+            hidden[stateOffset + j] = o * Math.tanh(c);
+        }
+    }
+}
+
+/**
+ * @brief Gated recurrent unit layer with gates ordered reset, update, candidate
+ */
+class GruLayer extends RecurrentLayer {
+    /**
+     * @brief Constructs a GRU
+     * @param inputSize Width of each time step's input
+     * @param hiddenSize Width of the hidden state
+     */
+    public GruLayer(int inputSize, int hiddenSize) {
+        super(inputSize, hiddenSize, 3);
+    }
+
+    /**
+     * @brief n = tanh(x_n + r * h_n), h' = (1 - z) * n + z * h
+     */
+    @Override
+    protected void step(double[] projected, int projectedOffset, double[] recurrent, int recurrentOffset,
+                        double[] hidden, double[] cell, int stateOffset) {
+        int h = hiddenSize;
+        for (int j = 0; j < h; j++) {
+            double r = Neuron.sigmoid(projected[projectedOffset + j] + recurrent[recurrentOffset + j] + biases[j]);
+            double z = Neuron.sigmoid(projected[projectedOffset + h + j] + recurrent[recurrentOffset + h + j] + biases[h + j]);
+            double n = Math.tanh(projected[projectedOffset + 2 * h + j] + biases[2 * h + j] + r * recurrent[recurrentOffset + 2 * h + j]);
+            hidden[stateOffset + j] = (1.0 - z) * n + z * hidden[stateOffset + j];
+        }
+    }
+}
+
+/**
+ * @brief Multi-head self-attention computed in tiles with a streaming softmax
+ *
+ * Queries, keys and values for all heads come from one matrix product with
+ * the concatenated (model x 3*model) projection. Each head then processes
+ * QUERY_TILE queries at a time against KEY_TILE keys at a time, keeping a
+ * running maximum, normaliser and weighted value sum per query and rescaling
+ * them when the maximum grows. The sequence x sequence score matrix is never
+ * stored, so memory stays linear in the sequence length. (head, query tile)
+ * pairs run in parallel for long sequences.
+ */
+class AttentionLayer {
+    /** Queries processed together */
+    static final int QUERY_TILE = 32;
+    /** Keys loaded per step of the streaming softmax */
+    static final int KEY_TILE = 64;
+
+    /** Width of each position's vector */
+    private final int modelSize;
+    /** Number of heads */
+    private final int heads;
+    /** Width of each head */
+    private final int headSize;
+    /** Whether positions may only attend to themselves and earlier positions */
+    private final boolean causal;
+    /** Row-major (modelSize x 3*modelSize) query, key and value projections */
+    private final double[] qkvWeights;
+    /** Row-major (modelSize x modelSize) output projection */
+    private final double[] outputWeights;
+
+    /**
+     * @brief Constructs an attention layer with random projections
+     * @param modelSize Width of each position's vector
+     * @param heads Number of heads; must divide modelSize
+     * @param causal Whether to mask attention to later positions
+     */
+    public AttentionLayer(int modelSize, int heads, boolean causal) {
+        if (heads < 1 || modelSize % heads != 0) {
+            throw new IllegalArgumentException("Number of heads must divide the model size");
+        }
+        this.modelSize = modelSize;
+        this.heads = heads;
+        this.headSize = modelSize / heads;
+        this.causal = causal;
+        qkvWeights = new double[modelSize * 3 * modelSize];
+        outputWeights = new double[modelSize * modelSize];
+        Random rand = new Random();
+        double scale = 1.0 / Math.sqrt(modelSize);
+        for (int i = 0; i < qkvWeights.length; i++) {
+            qkvWeights[i] = rand.nextGaussian() * scale;
+        }
+        for (int i = 0; i < outputWeights.length; i++) {
+            outputWeights[i] = rand.nextGaussian() * scale;
+        }
+    }
+
+    /**
+     * @brief Applies self-attention to a sequence
+     * @param sequence Row-major length x modelSize input
+     * @param length Number of positions
+     * @return Row-major length x modelSize output
+     */
+    public double[] forward(double[] sequence, int length) {
+        if (sequence.length != length * modelSize) {
+            throw new IllegalArgumentException("Input size must match length x model size");
+        }
+        double[] qkv = MatrixOps.multiply(sequence, qkvWeights, length, modelSize, 3 * modelSize);
+        double[] context = new double[length * modelSize];
+
+        int queryTiles = (length + QUERY_TILE - 1) / QUERY_TILE;
+        IntStream tasks = IntStream.range(0, heads * queryTiles);
+        if ((long) length * length * modelSize >= MatrixOps.PARALLEL_THRESHOLD) {
+            tasks = tasks.parallel();
+        }
+        tasks.forEach(task -> attendTile(qkv, context, length, task / queryTiles, (task % queryTiles) * QUERY_TILE));
+
+        return MatrixOps.multiply(context, outputWeights, length, modelSize, modelSize);
+    }
+
+    /**
+     * @brief Computes one head's output for one tile of queries
+     * @param qkv Row-major length x 3*modelSize projections
+     * @param context Row-major length x modelSize output of all heads
+     * @param length Number of positions
+     * @param head Head index
+     * @param queryStart First query position of the tile
+     */
+    private void attendTile(double[] qkv, double[] context, int length, int head, int queryStart) {
+        int queryEnd = Math.min(length, queryStart + QUERY_TILE);
+        int rows = queryEnd - queryStart;
+        int stride = 3 * modelSize;
+        int qOff = head * headSize;
+        int kOff = modelSize + head * headSize;
+        int vOff = 2 * modelSize + head * headSize;
+        double scale = 1.0 / Math.sqrt(headSize);
+
+        double[] runningMax = new double[rows];
+        double[] runningSum = new double[rows];
+        double[] acc = new double[rows * headSize];
+        double[] scores = new double[KEY_TILE];
+        Arrays.fill(runningMax, Double.NEGATIVE_INFINITY);
+
+        int keyEnd = causal ? queryEnd : length;
+        for (int keyStart = 0; keyStart < keyEnd; keyStart += KEY_TILE) {
+            int tileEnd = Math.min(keyEnd, keyStart + KEY_TILE);
+            for (int i = 0; i < rows; i++) {
+                int query = queryStart + i;
+                int limit = causal ? Math.min(tileEnd, query + 1) : tileEnd;
+                if (limit <= keyStart) {
+                    continue;
+                }
+                int qBase = query * stride + qOff;
+
+                double tileMax = Double.NEGATIVE_INFINITY;
+                for (int j = keyStart; j < limit; j++) {
+                    int kBase = j * stride + kOff;
+                    double dot = 0.0;
+                    for (int d = 0; d < headSize; d++) {
+                        dot += qkv[qBase + d] * qkv[kBase + d];
+                    }
+                    scores[j - keyStart] = dot * scale;
+                    tileMax = Math.max(tileMax, scores[j - keyStart]);
+                }
+
+                // Rescale what was accumulated under the old maximum
+                double newMax = Math.max(runningMax[i], tileMax);
+                double correction = Math.exp(runningMax[i] - newMax);
+                runningSum[i] *= correction;
+                int accBase = i * headSize;
+                for (int d = 0; d < headSize; d++) {
+                    acc[accBase + d] *= correction;
+                }
+                for (int j = keyStart; j < limit; j++) {
+                    double p = Math.exp(scores[j - keyStart] - newMax);
+                    runningSum[i] += p;
+                    int vBase = j * stride + vOff;
+                    for (int d = 0; d < headSize; d++) {
+                        acc[accBase + d] += p * qkv[vBase + d];
+                    }
+                }
+                runningMax[i] = newMax;
+            }
+        }
+
+        for (int i = 0; i < rows; i++) {
+            int out = (queryStart + i) * modelSize + head * headSize;
+            double inv = runningSum[i] > 0.0 ? 1.0 / runningSum[i] : 0.0;
+            for (int d = 0; d < headSize; d++) {
+                context[out + d] = acc[i * headSize + d] * inv;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the width of each position's vector
+     * @return Model size
+     */
+    public int getModelSize() {
+        return modelSize;
+    }
+
+    /**
+     * @brief Get the number of heads
+     * @return Heads
+     */
+    public int getHeads() {
+        return heads;
+    }
+
+    /**
+     * @brief Get the concatenated query, key and value projections
+     * @return Row-major (modelSize x 3*modelSize) weights, shared with the layer
+     */
+    public double[] getQkvWeights() {
+        return qkvWeights;
+    }
+
+    /**
+     * @brief Get the output projection
+     * @return Row-major (modelSize x modelSize) weights, shared with the layer
+     */
+    public double[] getOutputWeights() {
+        return outputWeights;
+    }
+}
+
+/**
+ * @brief Mixture of expert layers where a gating layer routes each sample to its top-k experts
+ *
+ * The gate produces one logit per expert; the k largest are softmax-normalised
+ * into mixing weights and only those experts run. In a batch, samples are
+ * grouped by expert so each dense expert is evaluated once as a matrix
+ * product over its group, using the expert's cached transposed weights.
+ * Routing statistics use concurrent adders, so several threads may evaluate
+ * the layer at once. Routing counts and gate probabilities are kept for
+ * load-balancing diagnostics.
+ */
+class MixtureOfExpertsLayer extends Layer {
+    /** Layer mapping inputs to one logit per expert */
+    private final Layer gate;
+    /** Expert layers, all with the same input and output sizes */
+    private final List<Layer> experts;
+    /** Number of experts evaluated per sample */
+    private final int topK;
+    /** Samples routed to each expert since the last reset */
+    private final LongAdder[] routedCounts;
+    /** Sum of each expert's full-softmax gate probability since the last reset */
+    private final DoubleAdder[] gateProbabilitySums;
+    /** Samples seen since the last reset */
+    private final LongAdder samples = new LongAdder();
+
+    /**
+     * @brief Constructs a mixture of dense experts with a dense gate
+     * @param numInputs Input width
+     * @param numOutputs Output width of every expert
+     * @param numExperts Number of experts
+     * @param topK Experts evaluated per sample, between 1 and numExperts
+     */
+    public MixtureOfExpertsLayer(int numInputs, int numOutputs, int numExperts, int topK) {
+        if (topK < 1 || topK > numExperts) {
+            throw new IllegalArgumentException("Top-k must be between 1 and the number of experts");
+        }
+        gate = new Layer(numExperts, numInputs);
+        gate.setActivation(Activation.IDENTITY);
+        experts = new ArrayList<>(numExperts);
+        for (int e = 0; e < numExperts; e++) {
+            experts.add(new Layer(numOutputs, numInputs));
+        }
+        this.topK = topK;
+        routedCounts = new LongAdder[numExperts];
+        gateProbabilitySums = new DoubleAdder[numExperts];
+        for (int e = 0; e < numExperts; e++) {
+            routedCounts[e] = new LongAdder();
+            gateProbabilitySums[e] = new DoubleAdder();
+        }
+    }
+
+    /**
+     * @brief Evaluates one sample
+     * @param inputs List of input values to the layer
+     * @return Gate-weighted sum of the selected experts' outputs
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        return forwardBatch(Collections.singletonList(inputs)).get(0);
+    }
+
+    /**
+     * @brief Evaluates a batch, running each expert once over the samples routed to it
+     * @param batch Input samples
+     * @return Output of each sample, in input order
+     */
+    public List<List<Double>> forwardBatch(List<List<Double>> batch) {
+        int numExperts = experts.size();
+        int outputs = getOutputSize();
+        List<List<Integer>> members = new ArrayList<>(numExperts);
+        List<List<Double>> mixWeights = new ArrayList<>(numExperts);
+        for (int e = 0; e < numExperts; e++) {
+            members.add(new ArrayList<>());
+            mixWeights.add(new ArrayList<>());
+        }
+
+        for (int s = 0; s < batch.size(); s++) {
+            double[] logits = Utils.toArray(gate.activateLayer(batch.get(s)));
+            double lse = SoftmaxCrossEntropy.logSumExp(logits);
+            for (int e = 0; e < numExperts; e++) {
+                gateProbabilitySums[e].add(Math.exp(logits[e] - lse));
+            }
+
+            int[] chosen = topIndices(logits, topK);
+            double max = logits[chosen[0]];
+            double total = 0.0;
+            double[] weights = new double[topK];
+            for (int k = 0; k < topK; k++) {
+                weights[k] = Math.exp(logits[chosen[k]] - max);
+                total += weights[k];
+            }
+            for (int k = 0; k < topK; k++) {
+                members.get(chosen[k]).add(s);
+                mixWeights.get(chosen[k]).add(weights[k] / total);
+                routedCounts[chosen[k]].increment();
+            }
+        }
+        samples.add(batch.size());
+
+        double[][] results = new double[batch.size()][outputs];
+        for (int e = 0; e < numExperts; e++) {
+            List<Integer> group = members.get(e);
+            if (group.isEmpty()) {
+                continue;
+            }
+            double[] expertOut = evaluateGroup(experts.get(e), batch, group);
+            for (int m = 0; m < group.size(); m++) {
+                double w = mixWeights.get(e).get(m);
+                double[] target = results[group.get(m)];
+                for (int o = 0; o < outputs; o++) {
+                    target[o] += w * expertOut[m * outputs + o];
+                }
+            }
+        }
+
+        List<List<Double>> out = new ArrayList<>(batch.size());
+        for (double[] r : results) {
+            out.add(Utils.toList(r));
+        }
+        return out;
+    }
+
+    /**
+     * @brief Get the fraction of routed samples each expert received since the last reset
+     * @return Share of routing decisions per expert
+     */
+    public double[] getLoadFractions() {
+        double[] fractions = new double[experts.size()];
+        long total = samples.sum() * topK;
+        for (int e = 0; e < fractions.length; e++) {
+            fractions[e] = total > 0 ? (double) routedCounts[e].sum() / total : 0.0;
+        }
+        return fractions;
+    }
+
+    /**
+     * @brief Computes the auxiliary load-balancing loss numExperts * sum(load_e * meanGateProbability_e)
+     *
+     * It equals 1 when routing is perfectly uniform and grows as load concentrates on few experts.
+     * @return Load-balancing loss since the last reset
+     */
+    public double getLoadBalancingLoss() {
+        long seen = samples.sum();
+        if (seen == 0) {
+            return 0.0;
+        }
+        double[] fractions = getLoadFractions();
+        double loss = 0.0;
+        for (int e = 0; e < fractions.length; e++) {
+            loss += fractions[e] * gateProbabilitySums[e].sum() / seen;
+        }
+        return experts.size() * loss;
+    }
+
+    /**
+     * @brief Clears the routing statistics
+     */
+    public void resetStatistics() {
+        for (int e = 0; e < routedCounts.length; e++) {
+            routedCounts[e].reset();
+            gateProbabilitySums[e].reset();
+        }
+        samples.reset();
+    }
+
+    /**
+     * @brief Get the gating layer
+     * @return Gate
+     */
+    public Layer getGate() {
+        return gate;
+    }
+
+    /**
+     * @brief Get the expert layers
+     * @return Experts
+     */
+    public List<Layer> getExperts() {
+        return experts;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return gate.getInputSize();
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return experts.get(0).getOutputSize();
+    }
+
+    /**
+     * @brief Runs one expert over the samples routed to it
+     * @param expert Expert layer
+     * @param batch All input samples
+     * @param group Indices of the samples routed to this expert
+     * @return Row-major (group size x outputs) expert outputs
+     */
+    private static double[] evaluateGroup(Layer expert, List<List<Double>> batch, List<Integer> group) {
+        int in = expert.getInputSize();
+        int out = expert.getOutputSize();
+        double[] result;
+        if (expert.getNeurons().isEmpty()) {
+            result = new double[group.size() * out];
+            for (int m = 0; m < group.size(); m++) {
+                double[] y = Utils.toArray(expert.activateLayer(batch.get(group.get(m))));
+                System.arraycopy(y, 0, result, m * out, out);
+            }
+            return result;
+        }
+
+        double[] x = new double[group.size() * in];
+        for (int m = 0; m < group.size(); m++) {
+            List<Double> sample = batch.get(group.get(m));
+            if (sample.size() != in) {
+                throw new IllegalArgumentException("Number of inputs must match number of weights");
+            }
+            for (int c = 0; c < in; c++) {
+                x[m * in + c] = sample.get(c);
+            }
+        }
+        result = MatrixOps.multiply(x, expert.getColumnMajorWeights(), group.size(), in, out);
+        double[] biases = expert.getBiasVector();
+        double[] row = new double[out];
+        for (int m = 0; m < group.size(); m++) {
+            System.arraycopy(result, m * out, row, 0, out);
+            expert.getActivation().apply(row, biases, row);
+            System.arraycopy(row, 0, result, m * out, out);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Finds the indices of the k largest values, largest first
+     * @param values Values to search
+     * @param k Number of indices to return
+     * @return Indices of the k largest values
+     */
+    private static int[] topIndices(double[] values, int k) {
+        int[] best = new int[k];
+        boolean[] taken = new boolean[values.length];
+        for (int slot = 0; slot < k; slot++) {
+            int arg = -1;
+            for (int i = 0; i < values.length; i++) {
+                if (!taken[i] && (arg < 0 || values[i] > values[arg])) {
+                    arg = i;
+                }
+            }
+            taken[arg] = true;
+            best[slot] = arg;
+        }
+        return best;
+    }
+}
+
+/**
+ * @brief Classifier attached after an intermediate layer that can end inference early
+ *
+ * The head produces logits; it is trained with the fused softmax
+ * cross-entropy and the softmax is applied only when deciding whether to exit.
+ */
+class ExitHead {
+    /** Index of the layer whose output feeds the head */
+    private final int layerIndex;
+    /** Dense IDENTITY layer producing class logits */
+    private final Layer head;
+    /** Top probability at or above which inference stops here */
+    private final double threshold;
+    /** Inferences that reached this exit */
+    private long reached;
+    /** Inferences that stopped at this exit */
+    private long taken;
+
+    /**
+     * @brief Constructs an exit head with random weights
+     * @param layerIndex Index of the layer whose output feeds the head
+     * @param numInputs Output width of that layer
+     * @param numClasses Number of classes, matching the network's final output
+     * @param threshold Top probability at or above which inference stops here
+     */
+    public ExitHead(int layerIndex, int numInputs, int numClasses, double threshold) {
+        this.layerIndex = layerIndex;
+        this.threshold = threshold;
+        head = new Layer(numClasses, numInputs);
+        head.setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Evaluates the head and records whether it was confident enough to exit
+     * @param features Output of the layer the head is attached to
+     * @return Class probabilities if the exit is taken, otherwise null
+     */
+    public List<Double> tryExit(List<Double> features) {
+        reached++;
+        double[] logits = Utils.toArray(head.activateLayer(features));
+        double[] probabilities = new double[logits.length];
+        Activation.SOFTMAX.apply(logits, new double[logits.length], probabilities);
+        if (Arrays.stream(probabilities).max().getAsDouble() >= threshold) {
+            taken++;
+            return Utils.toList(probabilities);
+        }
+        return null;
+    }
+
+    /**
+     * @brief Runs one gradient step of cross-entropy on the head alone
+     * @param features Output of the layer the head is attached to
+     * @param label Index of the correct class
+     * @param learningRate Step size
+     */
+    public void train(List<Double> features, int label, double learningRate) {
+        List<Double> logits = head.activateLayer(features);
+        double[] gradients = new double[logits.size()];
+        SoftmaxCrossEntropy.lossAndGradient(Utils.toArray(logits), label, gradients);
+        head.backward(features, logits, Utils.toList(gradients));
+        head.applyGradients(learningRate);
+    }
+
+    /**
+     * @brief Get the index of the layer feeding this head
+     * @return Layer index
+     */
+    public int getLayerIndex() {
+        return layerIndex;
+    }
+
+    /**
+     * @brief Get the fraction of inferences reaching this exit that stopped here
+     * @return Hit rate, or 0 if the exit was never reached
+     */
+    public double getHitRate() {
+        return reached > 0 ? (double) taken / reached : 0.0;
+    }
+
+    /**
+     * @brief Get the number of inferences that stopped at this exit
+     * @return Exit count
+     */
+    public long getTakenCount() {
+        return taken;
+    }
+}
+
+/**
+ * @brief Inverted dropout whose mask comes from a counter-based generator
+ *
+ * The keep/drop decision for element i is a pure function of (seed, step,
+ * i): one 64-bit mix yields four 16-bit uniforms, so a mask costs a quarter
+ * of a hash per element and is never stored. Backward regenerates the same
+ * mask from the same step, then advances the step so the next sample gets a
+ * fresh mask; a forward recomputed before backward reproduces its mask. Below
+ * the lowest trainable layer, where backward does not reach, the network
+ * advances the step through advance() instead. Outside training mode the
+ * layer is the identity.
+ */
+class DropoutLayer extends Layer {
+    /** Number of inputs and outputs */
+    private final int size;
+    /** Probability of dropping each element */
+    private final double rate;
+    /** Seed of the mask generator */
+    private final long seed;
+    /** Mask counter, advanced after each backward or advance() */
+    private long step;
+    /** Whether masks are applied */
+    private boolean training;
+
+    /**
+     * @brief Constructs a dropout layer, initially not in training mode
+     * @param size Number of inputs and outputs
+     * @param rate Probability of dropping each element, in [0, 1)
+     * @param seed Seed of the mask generator
+     */
+    public DropoutLayer(int size, double rate, long seed) {
+        if (rate < 0.0 || rate >= 1.0) {
+            throw new IllegalArgumentException("Dropout rate must be in [0, 1)");
+        }
+        this.size = size;
+        this.rate = rate;
+        this.seed = seed;
+        setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Constructs a copy that continues from the same mask counter and mode
+     * @param other Dropout layer to copy
+     */
+    public DropoutLayer(DropoutLayer other) {
+        size = other.size;
+        rate = other.rate;
+        seed = other.seed;
+        step = other.step;
+        training = other.training;
+        setActivation(Activation.IDENTITY);
+    }
+
+    /**
+     * @brief Drops and rescales inputs in training mode, passes them through otherwise
+     * @param inputs List of input values to the layer
+     * @return List of output values
+     */
+    @Override
+    public List<Double> activateLayer(List<Double> inputs) {
+        if (inputs.size() != size) {
+            throw new IllegalArgumentException("Input size must match dropout size");
+        }
+        if (!training) {
+            return new ArrayList<>(inputs);
+        }
+        return Utils.toList(applyMask(Utils.toArray(inputs)));
+    }
+
+    /**
+     * @brief Applies the regenerated mask to the gradients and advances the mask counter
+     * @param inputs Inputs the layer received in the forward pass
+     * @param outputs Outputs the layer produced in the forward pass
+     * @param outputGradients Gradient of the loss with respect to each output
+     * @return Gradient of the loss with respect to each input
+     */
+    @Override
+    public List<Double> backward(List<Double> inputs, List<Double> outputs, List<Double> outputGradients) {
+        if (!training) {
+            return new ArrayList<>(outputGradients);
+        }
+        double[] g = applyMask(Utils.toArray(outputGradients));
+        step++;
+        return Utils.toList(g);
+    }
+
+    /**
+     * @brief Dropout has no parameters to update
+     * @param learningRate Ignored
+     */
+    @Override
+    public void applyGradients(double learningRate) {
+    }
+
+    /**
+     * @brief Moves on to the next sample's mask for a sample that was not back-propagated through this layer
+     */
+    public void advance() {
+        if (training) {
+            step++;
+        }
+    }
+
+    /**
+     * @brief Turns mask application on or off
+     * @param training Whether the layer is being trained
+     */
+    public void setTraining(boolean training) {
+        this.training = training;
+    }
+
+    /**
+     * @brief Checks whether masks are applied
+     * @return True in training mode
+     */
+    public boolean isTraining() {
+        return training;
+    }
+
+    /**
+     * @brief Get the number of inputs this layer expects
+     * @return Input width of the layer
+     */
+    @Override
+    public int getInputSize() {
+        return size;
+    }
+
+    /**
+     * @brief Get the number of outputs this layer produces
+     * @return Output width of the layer
+     */
+    @Override
+    public int getOutputSize() {
+        return size;
+    }
+
+    /**
+     * @brief Zeroes dropped elements and scales kept ones by 1 / (1 - rate) in one pass
+     * @param values Values to mask, modified in place
+     * @return The same array
+     */
+    private double[] applyMask(double[] values) {
+        int threshold = (int) Math.round(rate * 65536.0);
+        double scale = 1.0 / (1.0 - rate);
+        long base = Utils.mix64(seed) + step * 0x9e3779b97f4a7c15L;
+        for (int i = 0; i < values.length; i += 4) {
+            long bits = Utils.mix64(base + (i >>> 2));
+            int end = Math.min(values.length, i + 4);
+            for (int j = i; j < end; j++) {
+                int u = (int) (bits & 0xffff);
+                bits >>>= 16;
+                values[j] = u >= threshold ? values[j] * scale : 0.0;
+            }
+        }
+        return values;
+    }
+}
+
+/**
+ * @brief Outputs of a frozen trunk of layers, computed once and reused for every epoch of fine-tuning
+ *
+ * Rows live in DoubleBuffers, either on the heap or memory-mapped from a file
+ * so that caches larger than the heap are paged in by the operating system as
+ * they are read. Mappings are split into chunks of whole rows below 2 GB.
+ */
+class TrunkCache {
+    /** Index of the first layer above the trunk, which consumes the cached rows */
+    private final int layer;
+    /** Number of cached samples */
+    private final int samples;
+    /** Values per sample */
+    private final int width;
+    /** Samples per chunk */
+    private final int rowsPerChunk;
+    /** Row-major storage, rowsPerChunk samples per buffer */
+    private final DoubleBuffer[] chunks;
+
+    /**
+     * @brief Constructs an empty cache on the heap
+     * @param layer Index of the first layer above the trunk
+     * @param samples Number of samples
+     * @param width Outputs of the trunk per sample
+     */
+    public TrunkCache(int layer, int samples, int width) {
+        this(layer, samples, width, samples);
+        if ((long) samples * width > Integer.MAX_VALUE - 8) {
+            throw new IllegalArgumentException("Cache is too large for the heap; use a memory-mapped cache");
+        }
+        chunks[0] = DoubleBuffer.allocate(samples * width);
+    }
+
+    /**
+     * @brief Validates the shape and sets up the chunk table
+     * @param layer Index of the first layer above the trunk
+     * @param samples Number of samples
+     * @param width Outputs of the trunk per sample
+     * @param rowsPerChunk Samples per buffer
+     */
+    private TrunkCache(int layer, int samples, int width, int rowsPerChunk) {
+        if (layer < 0 || samples < 0 || width <= 0) {
+            throw new IllegalArgumentException("Layer and samples must be non-negative and width positive");
+        }
+        this.layer = layer;
+        this.samples = samples;
+        this.width = width;
+        this.rowsPerChunk = Math.max(1, rowsPerChunk);
+        this.chunks = new DoubleBuffer[Math.max(1, (samples + this.rowsPerChunk - 1) / this.rowsPerChunk)];
+    }
+
+    /**
+     * @brief Creates a cache backed by a memory-mapped file, creating or resizing the file as needed
+     * @param filename File to map
+     * @param layer Index of the first layer above the trunk
+     * @param samples Number of samples
+     * @param width Outputs of the trunk per sample
+     * @return Empty cache whose rows are written through to the file
+     * @throws IOException If the file cannot be created or mapped
+     */
+    public static TrunkCache mapped(String filename, int layer, int samples, int width) throws IOException {
+        TrunkCache cache = new TrunkCache(layer, samples, width, Integer.MAX_VALUE / Double.BYTES / Math.max(1, width));
+        try (FileChannel channel = FileChannel.open(Paths.get(filename),
+                StandardOpenOption.CREATE, StandardOpenOption.READ, StandardOpenOption.WRITE)) {
+            for (int k = 0; k < cache.chunks.length; k++) {
+                long firstRow = (long) k * cache.rowsPerChunk;
+                int rows = (int) Math.min(cache.rowsPerChunk, samples - firstRow);
+                long offset = firstRow * width * Double.BYTES;
+                long bytes = (long) rows * width * Double.BYTES;
+                cache.chunks[k] = channel.map(FileChannel.MapMode.READ_WRITE, offset, bytes).asDoubleBuffer();
+            }
+        }
+        return cache;
+    }
+
+    /**
+     * @brief Stores the trunk outputs of one sample
+     * @param sample Sample index
+     * @param row Trunk outputs, width values
+     */
+    public void put(int sample, double[] row) {
+        if (row.length != width) {
+            throw new IllegalArgumentException("Row size must match cache width");
+        }
+        DoubleBuffer buffer = row(sample);
+        buffer.put(row);
+    }
+
+    /**
+     * @brief Reads the trunk outputs of one sample
+     * @param sample Sample index
+     * @return Trunk outputs, width values
+     */
+    public List<Double> get(int sample) {
+        double[] row = new double[width];
+        row(sample).get(row);
+        return Utils.toList(row);
+    }
+
+    /**
+     * @brief Positions an independent view of the chunk holding a sample at its row
+     * @param sample Sample index
+     * @return View positioned at the first value of the row
+     */
+    private DoubleBuffer row(int sample) {
+        if (sample < 0 || sample >= samples) {
+            throw new IllegalArgumentException("Sample index out of range");
+        }
+        DoubleBuffer buffer = chunks[sample / rowsPerChunk].duplicate();
+        buffer.position((sample % rowsPerChunk) * width);
+        return buffer;
+    }
+
+    /**
+     * @brief Get the index of the first layer above the cached trunk
+     * @return Layer index
+     */
+    public int getLayer() {
+        return layer;
+    }
+
+    /**
+     * @brief Get the number of cached samples
+     * @return Number of samples
+     */
+    public int size() {
+        return samples;
+    }
+
+    /**
+     * @brief Get the number of values cached per sample
+     * @return Width of each row
+     */
+    public int getWidth() {
+        return width;
+    }
+}
+
+/**
+ * @brief Neural network implementation
+ */
+class NeuralNetworkImpl {
+    /** List of layers in the network */
+    private List<Layer> layers;
+    /** Dense/sparse kernel choice for each layer's input, created on first forward */
+    private SparsityTuner[] tuners;
+    /** Whether forward switches to the compressed-activation kernel for sparse layer inputs; off by default */
+    private volatile boolean activationSparsity;
+    /** Early-exit classifiers, ordered by the layer they are attached to */
+    private List<ExitHead> exits = new ArrayList<>();
+    /** Layers whose inputs are kept during training, or null to keep every layer's input */
+    private SortedSet<Integer> checkpoints;
+    /** Samples whose gradients have been accumulated since the last step */
+    private int accumulatedSamples;
+    /** Factor the accumulated gradients were scaled by */
+    private double accumulatedLossScale = 1.0;
+    /** Layers excluded from training */
+    private BitSet frozen = new BitSet();
+
+    /**
+     * @brief Constructs a default neural network with 3 layers (3-3-3)
+     */
+    public NeuralNetworkImpl() {
+        this(Arrays.asList(3, 3, 3));
+    }
+
+    /**
+     * @brief Constructs a neural network with custom layer sizes
+     * @param layerSizes List containing the number of neurons in each layer
+     */
+    public NeuralNetworkImpl(List<Integer> layerSizes) {
+        if (layerSizes.size() < 2) {
+            throw new IllegalArgumentException("Neural network must have at least 2 layers");
+        }
+        
+        layers = new ArrayList<>();
+        
+        // Handle first layer specially
+        int firstInputSize = layerSizes.get(0); // For first layer, inputs = neurons for simplicity
+        layers.add(new Layer(layerSizes.get(0), firstInputSize));
+        
+        // For remaining layers, inputs come from previous layer
+        for (int i = 1; i < layerSizes.size(); i++) {
+            layers.add(new Layer(layerSizes.get(i), layerSizes.get(i-1)));
+        }
+    }
+
+    /**
+     * @brief Constructs a neural network with custom layer sizes and activations
+     * @param layerSizes List containing the number of neurons in each layer
+     * @param hiddenActivation Activation of every layer but the last
+     * @param outputActivation Activation of the last layer
+     */
+    public NeuralNetworkImpl(List<Integer> layerSizes, Activation hiddenActivation, Activation outputActivation) {
+        this(layerSizes);
+        for (int i = 0; i < layers.size(); i++) {
+            layers.get(i).setActivation(i + 1 < layers.size() ? hiddenActivation : outputActivation);
+        }
+    }
+
+    /**
+     * @brief Constructs a network from already built layers
+     * @param layers Layers in evaluation order
+     */
+    private NeuralNetworkImpl(Layer[] layers) {
+        if (layers.length < 2) {
+            throw new IllegalArgumentException("Neural network must have at least 2 layers");
+        }
+        this.layers = new ArrayList<>(Arrays.asList(layers));
+    }
+
+    /**
+     * @brief Creates a network from already built layers
+     * @param layers Layers in evaluation order
+     * @return Network evaluating the given layers
+     */
+    public static NeuralNetworkImpl fromLayers(List<Layer> layers) {
+        return new NeuralNetworkImpl(layers.toArray(new Layer[0]));
+    }
+
+    /**
+     * @brief Copies a layer so that the copy can be trained, pruned or reconfigured independently
+     *
+     * Dense, layer-norm, convolution and dropout layers are deep-copied. Tied
+     * layers and mixtures of experts, whose parameters live in objects shared
+     * with other layers, are rejected. Layers without trainable parameters
+     * (weight-converted, pooling, fixed normalisation and recurrent layers) are
+     * returned as they are.
+     * @param layer Layer to copy
+     * @return Independent copy, or the layer itself if it has no trainable parameters
+     */
+    private static Layer copyLayer(Layer layer) {
+        if (layer instanceof TiedLayer || layer instanceof MixtureOfExpertsLayer) {
+            throw new IllegalStateException("Layers with shared or nested parameters cannot be copied");
+        }
+        if (layer instanceof LayerNormLayer) {
+            return new LayerNormLayer((LayerNormLayer) layer);
+        }
+        if (layer instanceof Conv2DLayer) {
+            return new Conv2DLayer((Conv2DLayer) layer);
+        }
+        if (layer instanceof DropoutLayer) {
+            return new DropoutLayer((DropoutLayer) layer);
+        }
+        if (layer.getClass() != Layer.class || layer.getNeurons().isEmpty()) {
+            return layer;
+        }
+        List<Neuron> neurons = new ArrayList<>();
+        for (Neuron neuron : layer.getNeurons()) {
+            neurons.add(new Neuron(neuron.getWeights(), neuron.getBias()));
+        }
+        Layer copy = new Layer(neurons);
+        copy.setActivation(layer.getActivation());
+        return copy;
+    }
+
+    /**
+     * @brief Get all layers in this network
+     * @return List of layers
+     */
+    public List<Layer> getLayers() {
+        return layers;
+    }
+
+    /**
+     * @brief Builds an int8 copy of this network
+     *
+     * The calibration set is run through this network to record the largest
+     * input magnitude reaching each layer, which fixes that layer's input scale.
+     * @param calibrationSet Sample inputs representative of real traffic; may be empty
+     * @return Network with every layer converted to a QuantizedLayer
+     */
+    public NeuralNetworkImpl quantize(List<List<Double>> calibrationSet) {
+        requireDenseLayers("Quantisation");
+        double[] maxAbs = new double[layers.size()];
+        for (List<Double> sample : calibrationSet) {
+            List<List<Double>> outputs = forward(sample);
+            for (int i = 0; i < layers.size(); i++) {
+                for (double v : outputs.get(i)) {
+                    maxAbs[i] = Math.max(maxAbs[i], Math.abs(v));
+                }
+            }
+        }
+
+        Layer[] quantized = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            QuantizedLayer q = new QuantizedLayer(layers.get(i));
+            q.calibrate(maxAbs[i]);
+            quantized[i] = q;
+        }
+        return new NeuralNetworkImpl(quantized);
+    }
+
+    /**
+     * @brief Checks that every layer is a dense layer with neurons, as weight conversions require
+     * @param conversion Name of the conversion, for the error message
+     */
+    private void requireDenseLayers(String conversion) {
+        for (Layer layer : layers) {
+            if (layer.getNeurons().isEmpty()) {
+                throw new IllegalStateException(conversion + " requires dense layers");
+            }
+        }
+    }
+
+    /**
+     * @brief Builds a copy of this network with 16-bit weights
+     * @param format Storage format for every layer's weights
+     * @return Network with every layer converted to a HalfPrecisionLayer
+     */
+    public NeuralNetworkImpl toHalfPrecision(HalfPrecisionLayer.Format format) {
+        requireDenseLayers("16-bit conversion");
+        Layer[] converted = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            converted[i] = new HalfPrecisionLayer(layers.get(i), format);
+        }
+        return new NeuralNetworkImpl(converted);
+    }
+
+    /**
+     * @brief Builds a copy of this network with codebook-compressed weights
+     * @param clusters Number of centroids per layer, between 2 and 256
+     * @return Network with every layer converted to a CodebookLayer
+     */
+    public NeuralNetworkImpl compress(int clusters) {
+        requireDenseLayers("Codebook compression");
+        Layer[] converted = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            converted[i] = new CodebookLayer(layers.get(i), clusters);
+        }
+        return new NeuralNetworkImpl(converted);
+    }
+
+    /**
+     * @brief Builds a copy of this network with bit-packed binary or ternary layers
+     * @param ternary Whether to keep a zero level ({-1, 0, +1}) instead of +-1 only
+     * @return Network with every layer converted to a BinaryLayer or TernaryLayer
+     */
+    public NeuralNetworkImpl toLowBit(boolean ternary) {
+        requireDenseLayers("Low-bit conversion");
+        Layer[] converted = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            converted[i] = ternary ? new TernaryLayer(layers.get(i)) : new BinaryLayer(layers.get(i));
+        }
+        return new NeuralNetworkImpl(converted);
+    }
+
+    /**
+     * @brief Builds a copy of this network with low-rank factorised layers
+     *
+     * Layers for which the factorisation would not reduce the multiply-add
+     * count are kept dense. Layers that are not factorised are copied as
+     * described for copyLayer(), so tied layers and mixtures of experts are rejected.
+     * @param rank Rank of each factorisation
+     * @return Network with eligible layers converted to LowRankLayer
+     */
+    public NeuralNetworkImpl factorize(int rank) {
+        Layer[] converted = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            Layer layer = layers.get(i);
+            long dense = (long) layer.getOutputSize() * layer.getInputSize();
+            long factored = (long) rank * (layer.getOutputSize() + layer.getInputSize());
+            boolean eligible = !layer.getNeurons().isEmpty() && factored < dense;
+            converted[i] = eligible ? new LowRankLayer(layer, rank, i) : copyLayer(layer);
+        }
+        return new NeuralNetworkImpl(converted);
+    }
+
+    /**
+     * @brief Zeroes the smallest-magnitude weights of every dense layer in place
+     * @param targetSparsity Fraction of weights to zero, between 0 and 1
+     * @param global Whether to use one threshold across all layers instead of one per layer
+     * @return Fraction of weights that are zero afterwards
+     */
+    public double prune(double targetSparsity, boolean global) {
+        if (targetSparsity < 0.0 || targetSparsity > 1.0) {
+            throw new IllegalArgumentException("Target sparsity must be between 0 and 1");
+        }
+
+        List<Double> magnitudes = new ArrayList<>();
+        double[] thresholds = new double[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            List<Double> layerMagnitudes = new ArrayList<>();
+            for (Neuron neuron : layers.get(i).getNeurons()) {
+                for (double v : neuron.getWeights()) {
+                    layerMagnitudes.add(Math.abs(v));
+                }
+            }
+            thresholds[i] = magnitudeThreshold(layerMagnitudes, targetSparsity);
+            magnitudes.addAll(layerMagnitudes);
+        }
+        if (global) {
+            Arrays.fill(thresholds, magnitudeThreshold(magnitudes, targetSparsity));
+        }
+
+        long total = 0;
+        long zeros = 0;
+        for (int i = 0; i < layers.size(); i++) {
+            for (Neuron neuron : layers.get(i).getNeurons()) {
+                List<Double> w = neuron.getWeights();
+                for (int c = 0; c < w.size(); c++) {
+                    if (Math.abs(w.get(c)) < thresholds[i]) {
+                        w.set(c, 0.0);
+                    }
+                    if (w.get(c) == 0.0) {
+                        zeros++;
+                    }
+                    total++;
+                }
+            }
+            layers.get(i).weightsChanged();
+        }
+        return total > 0 ? (double) zeros / total : 0.0;
+    }
+
+    /**
+     * @brief Builds a smaller dense network by removing the lowest-scoring hidden neurons
+     *
+     * With a data set, neurons are scored by the variance of their output
+     * over it; otherwise by the L2 norm of their incoming weights. Each removed
+     * neuron's expected output (its mean over the data set, or its activation
+     * at zero input) times its outgoing weight is folded into the next layer's
+     * biases, and the matching input column of the next layer is dropped. The
+     * output layer is never pruned and every layer keeps at least one neuron.
+     * @param fraction Fraction of each hidden layer's neurons to remove, between 0 and 1
+     * @param dataSet Inputs for activation statistics, or an empty list to score by weight norm
+     * @return New network with the pruned layers
+     */
+    public NeuralNetworkImpl pruneNeurons(double fraction, List<List<Double>> dataSet) {
+        if (fraction < 0.0 || fraction > 1.0) {
+            throw new IllegalArgumentException("Fraction of neurons to remove must be between 0 and 1");
+        }
+        for (Layer layer : layers) {
+            if (layer.getNeurons().isEmpty()) {
+                throw new IllegalStateException("Structured pruning requires dense layers");
+            }
+        }
+
+        // Per-layer mean and variance of each neuron's output over the data set
+        double[][] mean = new double[layers.size()][];
+        double[][] variance = new double[layers.size()][];
+        for (int i = 0; i < layers.size(); i++) {
+            mean[i] = new double[layers.get(i).getOutputSize()];
+            variance[i] = new double[layers.get(i).getOutputSize()];
+        }
+        for (List<Double> sample : dataSet) {
+            List<List<Double>> outputs = forward(sample);
+            for (int i = 0; i < layers.size(); i++) {
+                List<Double> out = outputs.get(i + 1);
+                for (int n = 0; n < out.size(); n++) {
+                    mean[i][n] += out.get(n);
+                    variance[i][n] += out.get(n) * out.get(n);
+                }
+            }
+        }
+        for (int i = 0; i < layers.size() && !dataSet.isEmpty(); i++) {
+            for (int n = 0; n < mean[i].length; n++) {
+                mean[i][n] /= dataSet.size();
+                variance[i][n] = variance[i][n] / dataSet.size() - mean[i][n] * mean[i][n];
+            }
+        }
+
+        List<Neuron> current = new ArrayList<>(layers.get(0).getNeurons());
+        Layer[] pruned = new Layer[layers.size()];
+        for (int i = 0; i + 1 < layers.size(); i++) {
+            int count = current.size();
+            double[] score = new double[count];
+            for (int n = 0; n < count; n++) {
+                if (dataSet.isEmpty()) {
+                    for (double w : current.get(n).getWeights()) {
+                        score[n] += w * w;
+                    }
+                } else {
+                    score[n] = variance[i][n];
+                }
+            }
+
+            Integer[] order = new Integer[count];
+            for (int n = 0; n < count; n++) {
+                order[n] = n;
+            }
+            Arrays.sort(order, (a, b) -> Double.compare(score[a], score[b]));
+            int removeCount = Math.min(count - 1, (int) Math.round(fraction * count));
+            boolean[] removed = new boolean[count];
+            for (int k = 0; k < removeCount; k++) {
+                removed[order[k]] = true;
+            }
+
+            double[] idleOutputs = new double[count];
+            double[] currentBiases = new double[count];
+            for (int n = 0; n < count; n++) {
+                currentBiases[n] = current.get(n).getBias();
+            }
+            layers.get(i).getActivation().apply(new double[count], currentBiases, idleOutputs);
+
+            List<Neuron> kept = new ArrayList<>();
+            for (int n = 0; n < count; n++) {
+                if (!removed[n]) {
+                    Neuron neuron = current.get(n);
+                    kept.add(new Neuron(neuron.getWeights(), neuron.getBias()));
+                }
+            }
+            pruned[i] = new Layer(kept);
+            pruned[i].setActivation(layers.get(i).getActivation());
+
+            List<Neuron> next = new ArrayList<>();
+            for (Neuron neuron : layers.get(i + 1).getNeurons()) {
+                List<Double> w = neuron.getWeights();
+                List<Double> keptWeights = new ArrayList<>();
+                double bias = neuron.getBias();
+                for (int n = 0; n < count; n++) {
+                    if (!removed[n]) {
+                        keptWeights.add(w.get(n));
+                    } else {
+                        double expected = dataSet.isEmpty() ? idleOutputs[n] : mean[i][n];
+                        bias += w.get(n) * expected;
+                    }
+                }
+                next.add(new Neuron(keptWeights, bias));
+            }
+            current = next;
+        }
+        pruned[layers.size() - 1] = new Layer(current);
+        pruned[layers.size() - 1].setActivation(layers.get(layers.size() - 1).getActivation());
+        return new NeuralNetworkImpl(pruned);
+    }
+
+    /**
+     * @brief Builds a copy of this network using the fastest of the dense, CSR and block-sparse kernels per layer
+     *
+     * Each candidate is timed on the inputs that actually reach its layer for
+     * the given sample, so the choice reflects the sparsity the layer reached.
+     * Layers that stay unconverted are copied as described for copyLayer().
+     * @param sampleInput Representative network input used for timing
+     * @return Network whose layers are the fastest measured variant
+     */
+    public NeuralNetworkImpl sparsify(List<Double> sampleInput) {
+        List<List<Double>> layerInputs = forward(sampleInput);
+        Layer[] chosen = new Layer[layers.size()];
+        for (int i = 0; i < layers.size(); i++) {
+            Layer dense = layers.get(i);
+            List<Double> input = layerInputs.get(i);
+            Layer best = dense;
+            if (dense.getNeurons().isEmpty()) {
+                chosen[i] = copyLayer(dense);
+                continue;
+            }
+            long bestTime = timeLayer(dense, input);
+            for (Layer candidate : Arrays.asList(new CsrLayer(dense), new BlockSparseLayer(dense))) {
+                long time = timeLayer(candidate, input);
+                if (time < bestTime) {
+                    bestTime = time;
+                    best = candidate;
+                }
+            }
+            chosen[i] = best == dense ? copyLayer(dense) : best;
+        }
+        return new NeuralNetworkImpl(chosen);
+    }
+
+    /**
+     * @brief Finds the magnitude below which the given fraction of values fall
+     * @param magnitudes Absolute weight values
+     * @param sparsity Fraction of values to fall below the threshold
+     * @return Threshold magnitude
+     */
+    private static double magnitudeThreshold(List<Double> magnitudes, double sparsity) {
+        int k = (int) Math.round(sparsity * magnitudes.size());
+        if (k == 0) {
+            return 0.0;
+        }
+        if (k >= magnitudes.size()) {
+            return Double.POSITIVE_INFINITY;
+        }
+        List<Double> sorted = new ArrayList<>(magnitudes);
+        Collections.sort(sorted);
+        return sorted.get(k);
+    }
+
+    /**
+     * @brief Measures the best-of-several time of one layer evaluation after warm-up
+     * @param layer Layer to time
+     * @param input Input to the layer
+     * @return Fastest observed time in nanoseconds
+     */
+    private static long timeLayer(Layer layer, List<Double> input) {
+        for (int i = 0; i < 200; i++) {
+            layer.activateLayer(input);
+        }
+        long best = Long.MAX_VALUE;
+        for (int i = 0; i < 20; i++) {
+            long start = System.nanoTime();
+            layer.activateLayer(input);
+            best = Math.min(best, System.nanoTime() - start);
+        }
+        return best;
+    }
+
+    /**
+     * @brief Measures how far another network's outputs stray from this one's
+     *
+     * Used to check the accuracy of reduced-precision copies of a network.
+     * @param other Network to compare against, with the same input and output widths
+     * @param dataSet Inputs to evaluate both networks on
+     * @return Largest absolute difference between corresponding final outputs
+     */
+    public double maxOutputError(NeuralNetworkImpl other, List<List<Double>> dataSet) {
+        double maxError = 0.0;
+        for (List<Double> sample : dataSet) {
+            List<List<Double>> expected = forward(sample);
+            List<List<Double>> actual = other.forward(sample);
+            List<Double> e = expected.get(expected.size() - 1);
+            List<Double> a = actual.get(actual.size() - 1);
+            for (int i = 0; i < e.size(); i++) {
+                maxError = Math.max(maxError, Math.abs(e.get(i) - a.get(i)));
+            }
+        }
+        return maxError;
+    }
+
+    /**
+     * @brief Builds a copy of this network with an input normaliser folded into the first layer
+     *
+     * W' = W * diag(scale) and b' = b + W * shift, so the returned network
+     * takes raw inputs and needs no separate normalisation pass. The other
+     * layers are copied as described for copyLayer().
+     * @param normalizer Transform that would otherwise be applied to every input
+     * @return Network computing forward(normalizer.apply(x)) for raw x
+     */
+    public NeuralNetworkImpl withInputNormalizer(Normalizer normalizer) {
+        Layer[] folded = new Layer[layers.size()];
+        folded[0] = foldIntoInputs(normalizer, layers.get(0));
+        for (int i = 1; i < layers.size(); i++) {
+            folded[i] = copyLayer(layers.get(i));
+        }
+        return new NeuralNetworkImpl(folded);
+    }
+
+    /**
+     * @brief Builds an export copy of this network with every NormalizationLayer folded away
+     *
+     * A normalisation that directly follows a dense IDENTITY layer is folded
+     * into that layer's rows; otherwise it is folded into the columns of the
+     * dense layer after it. Normalisations with no dense neighbour, or with a
+     * non-identity activation of their own, are kept. Every other layer is
+     * copied as described for copyLayer(), so the export shares no trainable
+     * parameters with this network.
+     * @return Network with the same outputs and fewer passes
+     */
+    public NeuralNetworkImpl foldNormalization() {
+        List<Layer> result = new ArrayList<>();
+        for (int i = 0; i < layers.size(); i++) {
+            Layer layer = layers.get(i);
+            if (!(layer instanceof NormalizationLayer) || layer.getActivation() != Activation.IDENTITY) {
+                result.add(copyLayer(layer));
+                continue;
+            }
+            Normalizer normalizer = ((NormalizationLayer) layer).getNormalizer();
+            Layer previous = result.isEmpty() ? null : result.get(result.size() - 1);
+            Layer next = i + 1 < layers.size() ? layers.get(i + 1) : null;
+
+            if (previous != null && !previous.getNeurons().isEmpty() && previous.getActivation() == Activation.IDENTITY) {
+                result.set(result.size() - 1, foldIntoOutputs(previous, normalizer));
+            } else if (next != null && !next.getNeurons().isEmpty()) {
+                result.add(foldIntoInputs(normalizer, next));
+                i++;
+            } else {
+                result.add(layer);
+            }
+        }
+        return fromLayers(result);
+    }
+
+    /**
+     * @brief Folds a normalisation of a dense layer's inputs into its weights
+     * @param normalizer Transform applied before the layer
+     * @param layer Dense layer
+     * @return Equivalent dense layer taking untransformed inputs
+     */
+    private static Layer foldIntoInputs(Normalizer normalizer, Layer layer) {
+        if (layer.getNeurons().isEmpty() || layer.getInputSize() != normalizer.size()) {
+            throw new IllegalArgumentException("Normalizer can only be folded into a dense layer of matching input size");
+        }
+        double[] scale = normalizer.getScale();
+        double[] shift = normalizer.getShift();
+        List<Neuron> neurons = new ArrayList<>();
+        for (Neuron neuron : layer.getNeurons()) {
+            List<Double> w = neuron.getWeights();
+            List<Double> folded = new ArrayList<>(w.size());
+            double bias = neuron.getBias();
+            for (int c = 0; c < w.size(); c++) {
+                folded.add(w.get(c) * scale[c]);
+                bias += w.get(c) * shift[c];
+            }
+            neurons.add(new Neuron(folded, bias));
+        }
+        Layer result = new Layer(neurons);
+        result.setActivation(layer.getActivation());
+        return result;
+    }
+
+    /**
+     * @brief Folds a normalisation of an identity dense layer's outputs into its weights
+     * @param layer Dense layer with IDENTITY activation
+     * @param normalizer Transform applied after the layer
+     * @return Equivalent dense layer producing transformed outputs
+     */
+    private static Layer foldIntoOutputs(Layer layer, Normalizer normalizer) {
+        double[] scale = normalizer.getScale();
+        double[] shift = normalizer.getShift();
+        List<Neuron> neurons = new ArrayList<>();
+        for (int r = 0; r < layer.getNeurons().size(); r++) {
+            Neuron neuron = layer.getNeurons().get(r);
+            List<Double> folded = new ArrayList<>();
+            for (double w : neuron.getWeights()) {
+                folded.add(w * scale[r]);
+            }
+            neurons.add(new Neuron(folded, neuron.getBias() * scale[r] + shift[r]));
+        }
+        Layer result = new Layer(neurons);
+        result.setActivation(Activation.IDENTITY);
+        return result;
+    }
+
+    /**
+     * @brief Performs forward propagation through the network
+     * @param inputs List of input values to the network
+     * @return List of lists containing outputs at each layer, including the input
+     */
+    public List<List<Double>> forward(List<Double> inputs) {
+        if (inputs.size() != layers.get(0).getInputSize()) {
+            throw new IllegalArgumentException("Input size must match first layer's input size");
+        }
+        
+        List<List<Double>> allOutputs = new ArrayList<>();
+        allOutputs.add(new ArrayList<>(inputs)); // Store the original input
+        
+        List<Double> currentOutputs = inputs;
+        SparsityTuner[] layerTuners = activationSparsity ? sparsityTuners() : null;
+        
+        for (int i = 0; i < layers.size(); i++) {
+            Layer layer = layers.get(i);
+            // Layer outputs that are exactly zero (e.g. ternary) let the next layer skip weight columns
+            if (layerTuners != null && i > 0) {
+                currentOutputs = layerTuners[i].activate(layer, currentOutputs);
+            } else {
+                currentOutputs = layer.activateLayer(currentOutputs);
+            }
+            allOutputs.add(new ArrayList<>(currentOutputs)); // Make a copy
+        }
+        return allOutputs;
+    }
+
+    /**
+     * @brief Switches every DropoutLayer between training and inference behaviour
+     * @param training Whether the network is being trained
+     */
+    public void setTraining(boolean training) {
+        for (Layer layer : layers) {
+            if (layer instanceof DropoutLayer) {
+                ((DropoutLayer) layer).setTraining(training);
+            }
+        }
+    }
+
+    /**
+     * @brief Enables or disables the compressed-activation kernel for sparse layer inputs
+     *
+     * Off by default. Worth enabling for layers whose outputs are often
+     * exactly zero, such as ReLU or ternary layers; inputs without zeros
+     * always take the dense kernel.
+     * @param enabled Whether forward may skip the weight columns of zero activations
+     */
+    public void setActivationSparsity(boolean enabled) {
+        activationSparsity = enabled;
+    }
+
+    /**
+     * @brief Gets the per-layer kernel tuners, creating them if the layer count changed
+     * @return One tuner per layer
+     */
+    private synchronized SparsityTuner[] sparsityTuners() {
+        if (tuners == null || tuners.length != layers.size()) {
+            tuners = new SparsityTuner[layers.size()];
+            for (int i = 0; i < tuners.length; i++) {
+                tuners[i] = new SparsityTuner();
+            }
+        }
+        return tuners;
+    }
+
+    /**
+     * @brief Performs forward propagation for a sparse input vector
+     *
+     * The first layer reads only the weight columns of the non-zero inputs;
+     * the remaining layers run on the ordinary dense path.
+     * @param indices Positions of the non-zero inputs
+     * @param values Values of the non-zero inputs
+     * @return Output of the last layer
+     */
+    public List<Double> forwardSparse(int[] indices, double[] values) {
+        List<Double> currentOutputs = layers.get(0).activateSparse(indices, values);
+        for (int i = 1; i < layers.size(); i++) {
+            currentOutputs = layers.get(i).activateLayer(currentOutputs);
+        }
+        return currentOutputs;
+    }
+
+    /**
+     * @brief Attaches an early-exit classifier after an intermediate layer
+     * @param layerIndex Index of the layer whose output feeds the exit, before the last layer
+     * @param threshold Top probability at or above which inference stops there
+     * @return The new exit head, e.g. to train it or read its hit rate
+     */
+    public ExitHead addExit(int layerIndex, double threshold) {
+        if (layerIndex < 0 || layerIndex >= layers.size() - 1) {
+            throw new IllegalArgumentException("Exit must follow an intermediate layer");
+        }
+        ExitHead exit = new ExitHead(layerIndex, layers.get(layerIndex).getOutputSize(),
+                layers.get(layers.size() - 1).getOutputSize(), threshold);
+        exits.add(exit);
+        exits.sort(Comparator.comparingInt(ExitHead::getLayerIndex));
+        return exit;
+    }
+
+    /**
+     * @brief Runs layers until an exit head is confident enough, or to the end of the network
+     *
+     * The last layer must produce logits (IDENTITY), which are softmax-normalised,
+     * or probabilities (SOFTMAX), so every path returns probabilities.
+     * @param inputs List of input values to the network
+     * @return Class probabilities of the exit taken, or of the final layer
+     */
+    public List<Double> forwardWithExits(List<Double> inputs) {
+        if (inputs.size() != layers.get(0).getInputSize()) {
+            throw new IllegalArgumentException("Input size must match first layer's input size");
+        }
+        Activation last = layers.get(layers.size() - 1).getActivation();
+        if (last != Activation.IDENTITY && last != Activation.SOFTMAX) {
+            throw new IllegalStateException("Early exit requires an IDENTITY or SOFTMAX output layer");
+        }
+        List<Double> currentOutputs = inputs;
+        int nextExit = 0;
+        for (int i = 0; i < layers.size(); i++) {
+            currentOutputs = layers.get(i).activateLayer(currentOutputs);
+            while (nextExit < exits.size() && exits.get(nextExit).getLayerIndex() == i) {
+                List<Double> early = exits.get(nextExit++).tryExit(currentOutputs);
+                if (early != null) {
+                    return early;
+                }
+            }
+        }
+        if (last == Activation.IDENTITY) {
+            double[] logits = Utils.toArray(currentOutputs);
+            double[] probabilities = new double[logits.length];
+            Activation.SOFTMAX.apply(logits, new double[logits.length], probabilities);
+            return Utils.toList(probabilities);
+        }
+        return currentOutputs;
+    }
+
+    /**
+     * @brief Trains every exit head on one labelled sample, leaving the network's layers unchanged
+     * @param inputs List of input values to the network
+     * @param label Index of the correct class
+     * @param learningRate Step size
+     */
+    public void trainExits(List<Double> inputs, int label, double learningRate) {
+        List<List<Double>> outputs = forward(inputs);
+        for (ExitHead exit : exits) {
+            exit.train(outputs.get(exit.getLayerIndex() + 1), label, learningRate);
+        }
+    }
+
+    /**
+     * @brief Get the attached exit heads
+     * @return Exit heads ordered by layer
+     */
+    public List<ExitHead> getExits() {
+        return exits;
+    }
+
+    /**
+     * @brief Keeps only the inputs of the given layers during training and recomputes the rest in backward
+     * @param layerIndices Layers whose inputs are kept; the network input is always kept. Null keeps everything
+     */
+    public void setCheckpoints(Collection<Integer> layerIndices) {
+        if (layerIndices == null) {
+            checkpoints = null;
+            return;
+        }
+        checkpoints = new TreeSet<>(layerIndices);
+        checkpoints.add(0);
+    }
+
+    /**
+     * @brief Chooses and sets checkpoints that keep training activations within a memory budget
+     *
+     * If every layer's activations fit, nothing is recomputed. Otherwise the
+     * layers are split into k evenly sized segments for every k. Of the splits
+     * whose peak (kept checkpoint inputs plus the largest recomputed segment)
+     * fits the budget, the one recomputing the fewest activation values is
+     * used. If none fits, the split with the lowest peak is used, which is
+     * around sqrt(layers) segments.
+     * @param budget Number of activation values that may be held at once
+     * @return Chosen checkpoint layers, or null if everything is kept
+     */
+    public SortedSet<Integer> planCheckpoints(long budget) {
+        int n = layers.size();
+        long[] sizes = new long[n + 1];
+        sizes[0] = layers.get(0).getInputSize();
+        long total = sizes[0];
+        for (int i = 0; i < n; i++) {
+            sizes[i + 1] = layers.get(i).getOutputSize();
+            total += sizes[i + 1];
+        }
+        if (total <= budget) {
+            checkpoints = null;
+            return null;
+        }
+
+        SortedSet<Integer> lowestPeak = null;
+        long bestPeak = Long.MAX_VALUE;
+        SortedSet<Integer> cheapest = null;
+        long cheapestRecomputed = Long.MAX_VALUE;
+        for (int segments = 1; segments <= n; segments++) {
+            SortedSet<Integer> candidate = new TreeSet<>();
+            for (int k = 0; k < segments; k++) {
+                candidate.add((int) ((long) k * n / segments));
+            }
+            long kept = sizes[n];
+            long largestSegment = 0;
+            long recomputed = 0;
+            Integer[] starts = candidate.toArray(new Integer[0]);
+            for (int k = 0; k < starts.length; k++) {
+                int start = starts[k];
+                int end = k + 1 < starts.length ? starts[k + 1] : n;
+                kept += sizes[start];
+                long segment = 0;
+                for (int i = start + 1; i < end; i++) {
+                    segment += sizes[i];
+                }
+                largestSegment = Math.max(largestSegment, segment);
+                recomputed += segment;
+            }
+            long peak = kept + largestSegment;
+            if (peak < bestPeak) {
+                bestPeak = peak;
+                lowestPeak = candidate;
+            }
+            if (peak <= budget && recomputed < cheapestRecomputed) {
+                cheapestRecomputed = recomputed;
+                cheapest = candidate;
+            }
+        }
+        checkpoints = cheapest != null ? cheapest : lowestPeak;
+        return checkpoints;
+    }
+
+    /**
+     * @brief Freezes or unfreezes a layer; call between steps, not while gradients are accumulated
+     *
+     * Back-propagation stops at the lowest trainable layer, so frozen layers
+     * below it cost only their forward pass. Frozen layers above it still
+     * pass gradients through but are not updated.
+     * @param layerIndex Layer to change
+     * @param isFrozen Whether the layer's parameters stay fixed during training
+     */
+    public void setFrozen(int layerIndex, boolean isFrozen) {
+        if (layerIndex < 0 || layerIndex >= layers.size()) {
+            throw new IllegalArgumentException("Layer index out of range");
+        }
+        frozen.set(layerIndex, isFrozen);
+    }
+
+    /**
+     * @brief Freezes every layer below the given one and unfreezes the rest
+     * @param firstTrainable Index of the lowest layer to train; 0 trains the whole network
+     */
+    public void freezeBelow(int firstTrainable) {
+        if (firstTrainable < 0 || firstTrainable > layers.size()) {
+            throw new IllegalArgumentException("Layer index out of range");
+        }
+        frozen.clear();
+        frozen.set(0, firstTrainable);
+    }
+
+    /**
+     * @brief Checks whether a layer is frozen
+     * @param layerIndex Layer to check
+     * @return True if the layer is excluded from training
+     */
+    public boolean isFrozen(int layerIndex) {
+        return frozen.get(layerIndex);
+    }
+
+    /**
+     * @brief Finds where back-propagation can stop
+     * @return Index of the lowest layer that is not frozen, or the number of layers if all are
+     */
+    private int firstTrainableLayer() {
+        return Math.min(frozen.nextClearBit(0), layers.size());
+    }
+
+    /**
+     * @brief Performs forward propagation for training, keeping only the activations backward needs
+     * @param inputs List of input values to the network
+     * @return Like forward(), but with null for every layer input that is not a checkpoint or lies below the lowest trainable layer
+     */
+    public List<List<Double>> forwardForTraining(List<Double> inputs) {
+        if (checkpoints == null && frozen.isEmpty()) {
+            return forward(inputs);
+        }
+        return forwardForTraining(inputs, 0);
+    }
+
+    /**
+     * @brief Performs forward propagation for training starting at any layer
+     * @param inputs Inputs of the starting layer
+     * @param from Index of the starting layer
+     * @return Activations indexed like forward(), null below the starting layer and wherever backward does not need them
+     */
+    private List<List<Double>> forwardForTraining(List<Double> inputs, int from) {
+        if (inputs.size() != layers.get(from).getInputSize()) {
+            throw new IllegalArgumentException("Input size must match the starting layer's input size");
+        }
+        int trainable = firstTrainableLayer();
+        List<List<Double>> outputs = new ArrayList<>(Collections.nCopies(layers.size() + 1, (List<Double>) null));
+        outputs.set(from, new ArrayList<>(inputs));
+        List<Double> currentOutputs = inputs;
+        for (int i = from; i < layers.size(); i++) {
+            currentOutputs = layers.get(i).activateLayer(currentOutputs);
+            int index = i + 1;
+            if (index == layers.size() || index == trainable
+                    || index > trainable && (checkpoints == null || checkpoints.contains(index))) {
+                outputs.set(index, currentOutputs);
+            }
+        }
+        return outputs;
+    }
+
+    /**
+     * @brief Back-propagates output gradients through every layer, accumulating parameter gradients
+     *
+     * Missing (null) layer inputs are recomputed from the nearest earlier
+     * activation that was kept, one segment at a time, and each activation is
+     * released again once the layer above it has been back-propagated.
+     * Propagation stops at the lowest trainable layer.
+     * @param layerOutputs Result of forward() or forwardForTraining() for the sample being trained on
+     * @param outputGradients Gradient of the loss with respect to the final outputs
+     * @return Gradient of the loss with respect to the network inputs, e.g. for an EmbeddingLayer in front, or null if the bottom layer is frozen
+     */
+    public List<Double> backward(List<List<Double>> layerOutputs, List<Double> outputGradients) {
+        List<List<Double>> outputs = new ArrayList<>(layerOutputs);
+        List<Double> gradients = outputGradients;
+        int trainable = firstTrainableLayer();
+        for (int i = layers.size() - 1; i >= trainable; i--) {
+            if (outputs.get(i) == null) {
+                int start = i - 1;
+                while (outputs.get(start) == null) {
+                    start--;
+                }
+                for (int j = start; j < i; j++) {
+                    outputs.set(j + 1, layers.get(j).activateLayer(outputs.get(j)));
+                }
+            }
+            Layer layer = layers.get(i);
+            gradients = frozen.get(i)
+                    ? layer.backwardFrozen(outputs.get(i), outputs.get(i + 1), gradients)
+                    : layer.backward(outputs.get(i), outputs.get(i + 1), gradients);
+            if (checkpoints != null && i + 1 < layers.size()) {
+                outputs.set(i + 1, null);
+            }
+        }
+        // Dropout in the frozen trunk would otherwise reuse one mask for every sample
+        for (int i = 0; i < trainable; i++) {
+            if (layers.get(i) instanceof DropoutLayer) {
+                ((DropoutLayer) layers.get(i)).advance();
+            }
+        }
+        return trainable == 0 ? gradients : null;
+    }
+
+    /**
+     * @brief Takes a gradient descent step on every trainable layer and clears the gradients
+     * @param learningRate Step size
+     */
+    public void applyGradients(double learningRate) {
+        Set<SharedWeights> shared = new LinkedHashSet<>();
+        for (int i = firstTrainableLayer(); i < layers.size(); i++) {
+            Layer layer = layers.get(i);
+            // Frozen layers above the lowest trainable one received gradients that must not be applied
+            if (frozen.get(i)) {
+                layer.discardGradients();
+            } else {
+                layer.applyGradients(learningRate);
+                if (layer instanceof TiedLayer) {
+                    shared.add(((TiedLayer) layer).getSharedWeights());
+                }
+            }
+        }
+        // Each shared buffer is stepped once, however many of this network's layers use it
+        for (SharedWeights weights : shared) {
+            weights.applyGradients(learningRate, layers);
+        }
+        accumulatedSamples = 0;
+        accumulatedLossScale = 1.0;
+    }
+
+    /**
+     * @brief Adds one micro-batch's squared error gradients to the layers' gradient buffers without stepping
+     *
+     * Gradients keep accumulating in the same buffers across calls until
+     * stepAccumulated(), so the effective batch size is independent of how
+     * many samples are held in memory at once.
+     * @param inputs Input values of each sample
+     * @param targets Expected output values of each sample
+     * @param lossScale Factor applied to the loss before back-propagation, e.g. to keep small gradients representable; must be the same for every micro-batch of a step
+     * @return Sum of the unscaled sample losses
+     */
+    public double accumulateGradients(List<List<Double>> inputs, List<List<Double>> targets, double lossScale) {
+        if (inputs.size() != targets.size()) {
+            throw new IllegalArgumentException("Number of inputs must match number of targets");
+        }
+        beginAccumulation(lossScale);
+        double loss = 0.0;
+        for (int s = 0; s < inputs.size(); s++) {
+            loss += squaredErrorBackward(inputs.get(s), 0, targets.get(s), lossScale);
+        }
+        accumulatedSamples += inputs.size();
+        return loss;
+    }
+
+    /**
+     * @brief Adds one micro-batch's softmax cross-entropy gradients to the layers' gradient buffers without stepping
+     * @param inputs Input values of each sample
+     * @param labels Index of the correct class of each sample
+     * @param lossScale Factor applied to the loss before back-propagation; must be the same for every micro-batch of a step
+     * @return Sum of the unscaled sample losses
+     */
+    public double accumulateClassification(List<List<Double>> inputs, List<Integer> labels, double lossScale) {
+        if (inputs.size() != labels.size()) {
+            throw new IllegalArgumentException("Number of inputs must match number of labels");
+        }
+        beginAccumulation(lossScale);
+        double loss = 0.0;
+        for (int s = 0; s < inputs.size(); s++) {
+            loss += crossEntropyBackward(inputs.get(s), 0, labels.get(s), lossScale);
+        }
+        accumulatedSamples += inputs.size();
+        return loss;
+    }
+
+    /**
+     * @brief Takes one gradient descent step on the mean gradient of everything accumulated, then clears the buffers
+     *
+     * The loss scale and the sample count are divided out of the step size
+     * rather than the buffers, which is equivalent for plain gradient descent
+     * and saves a pass over every gradient.
+     * @param learningRate Step size for the mean gradient
+     * @return Number of samples the step averaged over
+     */
+    public int stepAccumulated(double learningRate) {
+        int samples = accumulatedSamples;
+        if (samples > 0) {
+            applyGradients(learningRate / (samples * accumulatedLossScale));
+        }
+        return samples;
+    }
+
+    /**
+     * @brief Checks that a micro-batch uses the same loss scale as the gradients already accumulated
+     * @param lossScale Loss scale of the new micro-batch
+     */
+    private void beginAccumulation(double lossScale) {
+        if (!(lossScale > 0.0) || Double.isInfinite(lossScale)) {
+            throw new IllegalArgumentException("Loss scale must be positive and finite");
+        }
+        if (accumulatedSamples > 0 && lossScale != accumulatedLossScale) {
+            throw new IllegalArgumentException("Loss scale cannot change between micro-batches of one step");
+        }
+        accumulatedLossScale = lossScale;
+    }
+
+    /**
+     * @brief Back-propagates the scaled squared error of one sample
+     * @param inputs Inputs of the starting layer
+     * @param from Index of the starting layer, above a cached trunk or 0
+     * @param targets Expected output values
+     * @param lossScale Factor applied to the output gradients
+     * @return Unscaled loss 0.5 * sum((output - target)^2)
+     */
+    private double squaredErrorBackward(List<Double> inputs, int from, List<Double> targets, double lossScale) {
+        List<List<Double>> outputs = from == 0 ? forwardForTraining(inputs) : forwardForTraining(inputs, from);
+        List<Double> predicted = outputs.get(outputs.size() - 1);
+        if (predicted.size() != targets.size()) {
+            throw new IllegalArgumentException("Target size must match last layer's output size");
+        }
+
+        double loss = 0.0;
+        List<Double> gradients = new ArrayList<>(targets.size());
+        for (int i = 0; i < targets.size(); i++) {
+            double error = predicted.get(i) - targets.get(i);
+            loss += 0.5 * error * error;
+            gradients.add(error * lossScale);
+        }
+        backward(outputs, gradients);
+        return loss;
+    }
+
+    /**
+     * @brief Back-propagates the scaled softmax cross-entropy of one sample
+     * @param inputs Inputs of the starting layer
+     * @param from Index of the starting layer, above a cached trunk or 0
+     * @param label Index of the correct class
+     * @param lossScale Factor applied to the output gradients
+     * @return Unscaled cross-entropy loss
+     */
+    private double crossEntropyBackward(List<Double> inputs, int from, int label, double lossScale) {
+        if (layers.get(layers.size() - 1).getActivation() != Activation.IDENTITY) {
+            throw new IllegalStateException("Classification training requires an IDENTITY output layer producing logits");
+        }
+        List<List<Double>> outputs = from == 0 ? forwardForTraining(inputs) : forwardForTraining(inputs, from);
+        double[] logits = Utils.toArray(outputs.get(outputs.size() - 1));
+        double[] gradients = new double[logits.length];
+        double loss = SoftmaxCrossEntropy.lossAndGradient(logits, label, gradients);
+        for (int i = 0; i < gradients.length; i++) {
+            gradients[i] *= lossScale;
+        }
+        backward(outputs, Utils.toList(gradients));
+        return loss;
+    }
+
+    /**
+     * @brief Runs one step of gradient descent on a single sample with squared error loss
+     * @param inputs Input values
+     * @param targets Expected output values
+     * @param learningRate Step size
+     * @return Loss 0.5 * sum((output - target)^2) before the step
+     */
+    public double trainStep(List<Double> inputs, List<Double> targets, double learningRate) {
+        double loss = squaredErrorBackward(inputs, 0, targets, 1.0);
+        applyGradients(learningRate);
+        return loss;
+    }
+
+    /**
+     * @brief Runs one step of gradient descent on a single sample with softmax cross-entropy loss
+     *
+     * The last layer must use the IDENTITY activation so that its outputs are
+     * the logits; the softmax is folded into the fused loss kernel, whose
+     * gradient softmax - onehot is passed straight back through the network.
+     * @param inputs Input values
+     * @param label Index of the correct class
+     * @param learningRate Step size
+     * @return Cross-entropy loss before the step
+     */
+    public double trainStepClassification(List<Double> inputs, int label, double learningRate) {
+        double loss = crossEntropyBackward(inputs, 0, label, 1.0);
+        applyGradients(learningRate);
+        return loss;
+    }
+
+    /**
+     * @brief Runs the frozen layers below the lowest trainable one once per sample and caches their outputs on the heap
+     *
+     * Dropout in the trunk must be in inference mode, since a cached row holds only one mask.
+     * @param inputs Network inputs of every training sample
+     * @return Cache to pass to trainStepCached() or trainStepClassificationCached() in every epoch
+     */
+    public TrunkCache cacheTrunk(List<List<Double>> inputs) {
+        int trunk = cacheableTrunk();
+        return fillTrunkCache(new TrunkCache(trunk, inputs.size(), layers.get(trunk).getInputSize()), inputs);
+    }
+
+    /**
+     * @brief Runs the frozen trunk once per sample and caches its outputs in a memory-mapped file
+     * @param inputs Network inputs of every training sample
+     * @param filename File backing the cache
+     * @return Cache to pass to trainStepCached() or trainStepClassificationCached() in every epoch
+     * @throws IOException If the file cannot be created or mapped
+     */
+    public TrunkCache cacheTrunk(List<List<Double>> inputs, String filename) throws IOException {
+        int trunk = cacheableTrunk();
+        return fillTrunkCache(TrunkCache.mapped(filename, trunk, inputs.size(), layers.get(trunk).getInputSize()), inputs);
+    }
+
+    /**
+     * @brief Finds the end of the frozen trunk
+     * @return Index of the lowest trainable layer
+     */
+    private int cacheableTrunk() {
+        int trunk = firstTrainableLayer();
+        if (trunk == layers.size()) {
+            throw new IllegalStateException("At least one layer must be trainable");
+        }
+        for (int i = 0; i < trunk; i++) {
+            Layer layer = layers.get(i);
+            if (layer instanceof DropoutLayer && ((DropoutLayer) layer).isTraining()) {
+                throw new IllegalStateException("Cannot cache a trunk whose dropout is in training mode");
+            }
+        }
+        return trunk;
+    }
+
+    /**
+     * @brief Computes the trunk outputs of every sample into a cache
+     * @param cache Cache to fill
+     * @param inputs Network inputs of every sample
+     * @return The filled cache
+     */
+    private TrunkCache fillTrunkCache(TrunkCache cache, List<List<Double>> inputs) {
+        for (int s = 0; s < inputs.size(); s++) {
+            List<Double> values = inputs.get(s);
+            if (values.size() != layers.get(0).getInputSize()) {
+                throw new IllegalArgumentException("Input size must match first layer's input size");
+            }
+            for (int i = 0; i < cache.getLayer(); i++) {
+                values = layers.get(i).activateLayer(values);
+            }
+            cache.put(s, Utils.toArray(values));
+        }
+        return cache;
+    }
+
+    /**
+     * @brief Checks that a cached trunk is still frozen
+     * @param cache Cache built by cacheTrunk()
+     */
+    private void checkTrunkCache(TrunkCache cache) {
+        if (cache.getLayer() > firstTrainableLayer() || cache.getLayer() >= layers.size()) {
+            throw new IllegalStateException("Layers inside the cached trunk have been unfrozen since the cache was built");
+        }
+    }
+
+    /**
+     * @brief Runs one step of gradient descent with squared error loss, starting from a sample's cached trunk outputs
+     *
+     * The cache stays valid as long as the trunk layers stay frozen.
+     * @param cache Cache built by cacheTrunk()
+     * @param sample Index of the sample in the cache
+     * @param targets Expected output values
+     * @param learningRate Step size
+     * @return Loss 0.5 * sum((output - target)^2) before the step
+     */
+    public double trainStepCached(TrunkCache cache, int sample, List<Double> targets, double learningRate) {
+        checkTrunkCache(cache);
+        double loss = squaredErrorBackward(cache.get(sample), cache.getLayer(), targets, 1.0);
+        applyGradients(learningRate);
+        return loss;
+    }
+
+    /**
+     * @brief Runs one step of gradient descent with softmax cross-entropy loss, starting from a sample's cached trunk outputs
+     * @param cache Cache built by cacheTrunk()
+     * @param sample Index of the sample in the cache
+     * @param label Index of the correct class
+     * @param learningRate Step size
+     * @return Cross-entropy loss before the step
+     */
+    public double trainStepClassificationCached(TrunkCache cache, int sample, int label, double learningRate) {
+        checkTrunkCache(cache);
+        double loss = crossEntropyBackward(cache.get(sample), cache.getLayer(), label, 1.0);
+        applyGradients(learningRate);
+        return loss;
+    }
+
+    /**
+     * @brief Saves the network outputs to a JSON file
+     * @param filename Name of the file to save to
+     * @param layerOutputs List of lists containing outputs at each layer
+     */
+    public void saveAsJson(String filename, List<List<Double>> layerOutputs) {
+        try (FileWriter file = new FileWriter(filename)) {
+            file.write("{\n  \"initial_input\": " + layerOutputs.get(0).toString() + ",\n");
+            
+            for (int i = 0; i < layers.size(); i++) {
+                file.write("  \"layer_" + (i + 1) + "_input\": " + layerOutputs.get(i).toString() + ",\n");
+                file.write("  \"layer_" + (i + 1) + "_output\": " + layerOutputs.get(i + 1).toString() + ",\n");
+            }
+            
+            file.write("  \"final_output\": " + layerOutputs.get(layerOutputs.size() - 1).toString() + "\n}");
+        } catch (IOException e) {
+            System.out.println("Unable to open file for writing: " + e.getMessage());
+        }
+    }
+}
+
+/**
+ * @brief Test class for neural network functionality
+ */
+class NeuralNetworkTest {
+    /**
+     * @brief Tests forward propagation with default network
+     * @param dataSet Input data for testing
+     */
+    public static void testForwardPropagation(List<Double> dataSet) {
+        NeuralNetworkImpl nn = new NeuralNetworkImpl();
+        List<List<Double>> outputs = nn.forward(dataSet);
+        Utils.consoleLog("Output from forward propagation: ", 33);
+        System.out.println(outputs.get(outputs.size() - 1));
+        nn.saveAsJson("neuralNetwork.json", outputs);
+    }
+
+    /**
+     * @brief Tests forward propagation with custom network
+     * @param inputNeurons Number of neurons in input layer
+     * @param hiddenNeurons Number of neurons in hidden layer
+     * @param outputNeurons Number of neurons in output layer
+     * @param dataSet Input data for testing
+     */
+    public static void testCustomNetwork(int inputNeurons, int hiddenNeurons, int outputNeurons, List<Double> dataSet) {
+        if (dataSet.size() != inputNeurons) {
+            throw new IllegalArgumentException("Input data size must match number of input neurons");
+        }
+        
+        NeuralNetworkImpl nnCustom = new NeuralNetworkImpl(Arrays.asList(inputNeurons, hiddenNeurons, outputNeurons));
+        List<List<Double>> outputs = nnCustom.forward(dataSet);
+        Utils.consoleLog("Output from custom network forward propagation: ", 33);
+        System.out.println(outputs.get(outputs.size() - 1));
+        nnCustom.saveAsJson("neuralNetwork.json", outputs);
+    }
+
+    /**
+     * @brief Compares a network against its int8 quantised copy
+     * @param dataSet Input data used both for calibration and comparison
+     */
+    public static void testQuantizedNetwork(List<Double> dataSet) {
+        NeuralNetworkImpl nn = seededNetwork(Arrays.asList(dataSet.size(), 3, 2), 11);
+        NeuralNetworkImpl quantized = nn.quantize(Collections.singletonList(dataSet));
+        List<List<Double>> expected = nn.forward(dataSet);
+        List<List<Double>> actual = quantized.forward(dataSet);
+        Utils.consoleLog("Output from int8 quantised forward propagation: ", 33);
+        System.out.println(actual.get(actual.size() - 1) + " (double: " + expected.get(expected.size() - 1) + ")");
+        if (nn.maxOutputError(quantized, Collections.singletonList(dataSet)) > 0.05) {
+            throw new IllegalStateException("Int8 network strays too far from the double network");
+        }
+    }
+
+    /**
+     * @brief Reports the output error of each reduced-precision copy of a network
+     * @param dataSet Input data for testing
+     */
+    public static void testReducedPrecision(List<Double> dataSet) {
+        NeuralNetworkImpl nn = seededNetwork(Arrays.asList(dataSet.size(), 3, 2), 13);
+        List<List<Double>> samples = Collections.singletonList(dataSet);
+        double int8 = nn.maxOutputError(nn.quantize(samples), samples);
+        double fp16 = nn.maxOutputError(nn.toHalfPrecision(HalfPrecisionLayer.Format.FP16), samples);
+        double bf16 = nn.maxOutputError(nn.toHalfPrecision(HalfPrecisionLayer.Format.BF16), samples);
+        double codebook = nn.maxOutputError(nn.compress(16), samples);
+        Utils.consoleLog("Max output error of reduced-precision networks: ", 33);
+        System.out.println("int8: " + int8);
+        System.out.println("fp16: " + fp16);
+        System.out.println("bf16: " + bf16);
+        System.out.println("codebook (16): " + codebook);
+        if (int8 > 0.05 || fp16 > 1e-3 || bf16 > 2e-2 || codebook > 0.05) {
+            throw new IllegalStateException("Reduced-precision network strays too far from the double network");
+        }
+    }
+
+    /**
+     * @brief Trains an autoencoder whose decoder reuses the transposed encoder weights
+     * @param dataSet Input data, also used as the reconstruction target
+     * @param hiddenNeurons Width of the code layer
+     */
+    public static void testTiedAutoencoder(List<Double> dataSet, int hiddenNeurons) {
+        SharedWeights shared = new SharedWeights(hiddenNeurons, dataSet.size());
+        NeuralNetworkImpl autoencoder = NeuralNetworkImpl.fromLayers(
+                Arrays.asList(new TiedLayer(shared, false), new TiedLayer(shared, true)));
+        double initialLoss = autoencoder.trainStep(dataSet, dataSet, 0.5);
+        double loss = initialLoss;
+        for (int epoch = 1; epoch < 100; epoch++) {
+            loss = autoencoder.trainStep(dataSet, dataSet, 0.5);
+        }
+        Utils.consoleLog("Tied autoencoder reconstruction loss: ", 33);
+        System.out.println(initialLoss + " -> " + loss);
+        if (!(loss < initialLoss)) {
+            throw new IllegalStateException("Tied autoencoder training did not reduce the loss");
+        }
+    }
+
+    /**
+     * @brief Checks that a checkpointed training step matches one that stores every activation
+     * @param dataSet Input data for testing
+     */
+    public static void testCheckpointedGradients(List<Double> dataSet) {
+        List<Integer> sizes = Arrays.asList(dataSet.size(), 5, 5, 5, 5, 2);
+        NeuralNetworkImpl full = seededNetwork(sizes, 42);
+        NeuralNetworkImpl checkpointed = seededNetwork(sizes, 42);
+        SortedSet<Integer> plan = checkpointed.planCheckpoints(dataSet.size() + 12);
+        List<Double> target = Arrays.asList(0.0, 1.0);
+        double fullLoss = full.trainStep(dataSet, target, 0.1);
+        double checkpointedLoss = checkpointed.trainStep(dataSet, target, 0.1);
+        double difference = maxParameterDifference(full, checkpointed);
+        Utils.consoleLog("Checkpoints " + plan + ", max parameter difference to full storage: ", 33);
+        System.out.println(difference);
+        if (difference > 1e-12 || fullLoss != checkpointedLoss) {
+            throw new IllegalStateException("Checkpointed training step differs from full storage");
+        }
+    }
+
+    /**
+     * @brief Checks that a loss-scaled step accumulated over micro-batches matches one step on the mean gradient
+     * @param dataSet Input data for testing, varied to form a batch of four samples
+     */
+    public static void testGradientAccumulation(List<Double> dataSet) {
+        List<List<Double>> batch = new ArrayList<>();
+        List<List<Double>> targets = new ArrayList<>();
+        for (int s = 0; s < 4; s++) {
+            List<Double> sample = new ArrayList<>();
+            for (double v : dataSet) {
+                sample.add(v * (1.0 + 0.25 * s));
+            }
+            batch.add(sample);
+            targets.add(Arrays.asList(s % 2 == 0 ? 1.0 : 0.0, s % 2 == 0 ? 0.0 : 1.0));
+        }
+        List<Integer> sizes = Arrays.asList(dataSet.size(), 5, 2);
+        NeuralNetworkImpl accumulated = seededNetwork(sizes, 7);
+        NeuralNetworkImpl reference = seededNetwork(sizes, 7);
+
+        accumulated.accumulateGradients(batch.subList(0, 2), targets.subList(0, 2), 1024.0);
+        accumulated.accumulateGradients(batch.subList(2, 4), targets.subList(2, 4), 1024.0);
+        accumulated.stepAccumulated(0.5);
+
+        for (int s = 0; s < batch.size(); s++) {
+            List<List<Double>> outputs = reference.forward(batch.get(s));
+            List<Double> predicted = outputs.get(outputs.size() - 1);
+            List<Double> gradients = new ArrayList<>();
+            for (int o = 0; o < predicted.size(); o++) {
+                gradients.add((predicted.get(o) - targets.get(s).get(o)) / batch.size());
+            }
+            reference.backward(outputs, gradients);
+        }
+        reference.applyGradients(0.5);
+
+        double difference = maxParameterDifference(accumulated, reference);
+        Utils.consoleLog("Max parameter difference of accumulated step to mean-gradient step: ", 33);
+        System.out.println(difference);
+        if (difference > 1e-12) {
+            throw new IllegalStateException("Accumulated step differs from the mean-gradient step");
+        }
+    }
+
+    /**
+     * @brief Checks the layer-norm input, gamma and beta gradients against central finite differences
+     */
+    public static void testLayerNormGradients() {
+        Random rand = new Random(5);
+        double error = 0.0;
+        for (Activation activation : Arrays.asList(Activation.IDENTITY, Activation.TANH, Activation.GELU)) {
+            LayerNormLayer layer = new LayerNormLayer(6, 1e-5);
+            layer.setActivation(activation);
+            double[] gamma = layer.getGamma();
+            double[] beta = layer.getBeta();
+            for (int i = 0; i < gamma.length; i++) {
+                gamma[i] = 1.0 + 0.3 * rand.nextGaussian();
+                beta[i] = 0.2 * rand.nextGaussian();
+            }
+            double[] x = randomArray(rand, 6);
+            double[] weights = randomArray(rand, 6);
+            List<Double> outputs = layer.activateLayer(Utils.toList(x));
+            double[] inputGradients = Utils.toArray(layer.backward(Utils.toList(x), outputs, Utils.toList(weights)));
+            error = Math.max(error, maxGradientError(layer, x, weights, x, inputGradients));
+            error = Math.max(error, maxGradientError(layer, x, weights, gamma, layer.getGammaGradients()));
+            error = Math.max(error, maxGradientError(layer, x, weights, beta, layer.getBetaGradients()));
+        }
+        Utils.consoleLog("Max layer-norm gradient error against finite differences: ", 33);
+        System.out.println(error);
+        if (error > 1e-6) {
+            throw new IllegalStateException("Layer-norm gradients disagree with finite differences");
+        }
+    }
+
+    /**
+     * @brief Checks convolution and pooling gradients against central finite differences,
+     * using a strided, padded convolution and overlapping pooling windows
+     */
+    public static void testConvolutionGradients() {
+        Random rand = new Random(17);
+        double error = 0.0;
+        for (Activation activation : Arrays.asList(Activation.IDENTITY, Activation.TANH)) {
+            Conv2DLayer conv = new Conv2DLayer(5, 6, 2, 3, 3, 2, 2, 1);
+            conv.setActivation(activation);
+            double[] biases = conv.getBiases();
+            for (int f = 0; f < biases.length; f++) {
+                biases[f] = 0.1 * rand.nextGaussian();
+            }
+            double[] x = randomArray(rand, conv.getInputSize());
+            double[] c = randomArray(rand, conv.getOutputSize());
+            List<Double> outputs = conv.activateLayer(Utils.toList(x));
+            double[] inputGradients = Utils.toArray(conv.backward(Utils.toList(x), outputs, Utils.toList(c)));
+            double[] weights = conv.getWeights();
+            double[] gradients = conv.getGradients();
+            error = Math.max(error, maxGradientError(conv, x, c, x, inputGradients));
+            error = Math.max(error, maxGradientError(conv, x, c, weights,
+                    Arrays.copyOfRange(gradients, 0, weights.length)));
+            error = Math.max(error, maxGradientError(conv, x, c, biases,
+                    Arrays.copyOfRange(gradients, weights.length, gradients.length)));
+        }
+        for (boolean max : new boolean[] {true, false}) {
+            PoolingLayer pool = new PoolingLayer(5, 5, 2, 3, 3, 2, max);
+            double[] x = randomArray(rand, pool.getInputSize());
+            double[] c = randomArray(rand, pool.getOutputSize());
+            List<Double> outputs = pool.activateLayer(Utils.toList(x));
+            double[] inputGradients = Utils.toArray(pool.backward(Utils.toList(x), outputs, Utils.toList(c)));
+            error = Math.max(error, maxGradientError(pool, x, c, x, inputGradients));
+        }
+        Utils.consoleLog("Max convolution and pooling gradient error against finite differences: ", 33);
+        System.out.println(error);
+        if (error > 1e-6) {
+            throw new IllegalStateException("Convolution or pooling gradients disagree with finite differences");
+        }
+    }
+
+    /**
+     * @brief Compares the im2col convolution of a batch with a direct nested-loop convolution
+     */
+    public static void testConvolutionForward() {
+        Random rand = new Random(19);
+        int height = 5, width = 6, channels = 2, filters = 3, kernelHeight = 3, kernelWidth = 2, stride = 2, padding = 1;
+        int batch = 2;
+        Conv2DLayer conv = new Conv2DLayer(height, width, channels, filters, kernelHeight, kernelWidth, stride, padding);
+        conv.setActivation(Activation.IDENTITY);
+        double[] weights = conv.getWeights();
+        double[] biases = conv.getBiases();
+        for (int f = 0; f < filters; f++) {
+            biases[f] = rand.nextGaussian();
+        }
+        double[] input = randomArray(rand, batch * conv.getInputSize());
+        double[] actual = conv.forward(input, batch);
+
+        int outHeight = (height + 2 * padding - kernelHeight) / stride + 1;
+        int outWidth = (width + 2 * padding - kernelWidth) / stride + 1;
+        double error = 0.0;
+        for (int n = 0; n < batch; n++) {
+            for (int oh = 0; oh < outHeight; oh++) {
+                for (int ow = 0; ow < outWidth; ow++) {
+                    for (int f = 0; f < filters; f++) {
+                        double sum = biases[f];
+                        for (int kh = 0; kh < kernelHeight; kh++) {
+                            for (int kw = 0; kw < kernelWidth; kw++) {
+                                int ih = oh * stride - padding + kh;
+                                int iw = ow * stride - padding + kw;
+                                if (ih < 0 || ih >= height || iw < 0 || iw >= width) {
+                                    continue;
+                                }
+                                for (int ch = 0; ch < channels; ch++) {
+                                    sum += input[((n * height + ih) * width + iw) * channels + ch]
+                                            * weights[((kh * kernelWidth + kw) * channels + ch) * filters + f];
+                                }
+                            }
+                        }
+                        int o = ((n * outHeight + oh) * outWidth + ow) * filters + f;
+                        error = Math.max(error, Math.abs(sum - actual[o]));
+                    }
+                }
+            }
+        }
+        Utils.consoleLog("Max im2col convolution error against a direct convolution: ", 33);
+        System.out.println(error);
+        if (actual.length != batch * outHeight * outWidth * filters || error > 1e-12) {
+            throw new IllegalStateException("im2col convolution disagrees with a direct convolution");
+        }
+    }
+
+    /**
+     * @brief Compares tiled streaming attention with softmax(QK^T / sqrt(d)) V over the full score matrix,
+     * for lengths that leave partial query and key tiles, with and without the causal mask
+     */
+    public static void testTiledAttention() {
+        Random rand = new Random(23);
+        int modelSize = 8;
+        double error = 0.0;
+        for (boolean causal : new boolean[] {false, true}) {
+            AttentionLayer attention = new AttentionLayer(modelSize, 2, causal);
+            for (int length : new int[] {1, AttentionLayer.QUERY_TILE + 13, AttentionLayer.KEY_TILE + 36}) {
+                double[] sequence = randomArray(rand, length * modelSize);
+                double[] actual = attention.forward(sequence, length);
+                double[] expected = referenceAttention(attention, sequence, length, causal);
+                for (int i = 0; i < expected.length; i++) {
+                    error = Math.max(error, Math.abs(expected[i] - actual[i]));
+                }
+            }
+        }
+        Utils.consoleLog("Max tiled attention error against the full softmax: ", 33);
+        System.out.println(error);
+        if (error > 1e-10) {
+            throw new IllegalStateException("Tiled attention disagrees with the full softmax");
+        }
+    }
+
+    /**
+     * @brief Computes multi-head attention directly, materialising every score row
+     * @param attention Layer whose projections to use
+     * @param sequence Row-major length x modelSize input
+     * @param length Number of positions
+     * @param causal Whether to mask attention to later positions
+     * @return Row-major length x modelSize output
+     */
+    private static double[] referenceAttention(AttentionLayer attention, double[] sequence, int length, boolean causal) {
+        int model = attention.getModelSize();
+        int headSize = model / attention.getHeads();
+        double[] qkvWeights = attention.getQkvWeights();
+        double[] outputWeights = attention.getOutputWeights();
+        double[] qkv = new double[length * 3 * model];
+        for (int t = 0; t < length; t++) {
+            for (int o = 0; o < 3 * model; o++) {
+                for (int m = 0; m < model; m++) {
+                    qkv[t * 3 * model + o] += sequence[t * model + m] * qkvWeights[m * 3 * model + o];
+                }
+            }
+        }
+
+        double[] context = new double[length * model];
+        double[] scores = new double[length];
+        for (int h = 0; h < attention.getHeads(); h++) {
+            for (int q = 0; q < length; q++) {
+                int keys = causal ? q + 1 : length;
+                double max = Double.NEGATIVE_INFINITY;
+                for (int k = 0; k < keys; k++) {
+                    double dot = 0.0;
+                    for (int d = 0; d < headSize; d++) {
+                        dot += qkv[q * 3 * model + h * headSize + d] * qkv[k * 3 * model + model + h * headSize + d];
+                    }
+                    scores[k] = dot / Math.sqrt(headSize);
+                    max = Math.max(max, scores[k]);
+                }
+                double total = 0.0;
+                for (int k = 0; k < keys; k++) {
+                    scores[k] = Math.exp(scores[k] - max);
+                    total += scores[k];
+                }
+                for (int k = 0; k < keys; k++) {
+                    for (int d = 0; d < headSize; d++) {
+                        context[q * model + h * headSize + d] +=
+                                scores[k] / total * qkv[k * 3 * model + 2 * model + h * headSize + d];
+                    }
+                }
+            }
+        }
+
+        double[] out = new double[length * model];
+        for (int t = 0; t < length; t++) {
+            for (int o = 0; o < model; o++) {
+                for (int m = 0; m < model; m++) {
+                    out[t * model + o] += context[t * model + m] * outputWeights[m * model + o];
+                }
+            }
+        }
+        return out;
+    }
+
+    /**
+     * @brief Checks that backward regenerates the forward dropout mask, that the next sample gets a
+     * fresh mask, and that the kept fraction matches 1 - rate
+     */
+    public static void testDropoutMask() {
+        int size = 4096;
+        double rate = 0.3;
+        DropoutLayer dropout = new DropoutLayer(size, rate, 7);
+        dropout.setTraining(true);
+        List<Double> ones = Collections.nCopies(size, 1.0);
+
+        List<Double> first = dropout.activateLayer(ones);
+        if (!first.equals(dropout.activateLayer(ones))) {
+            throw new IllegalStateException("Recomputed dropout forward changed its mask");
+        }
+        if (!first.equals(dropout.backward(ones, first, ones))) {
+            throw new IllegalStateException("Dropout backward mask differs from the forward mask");
+        }
+        List<Double> second = dropout.activateLayer(ones);
+        if (first.equals(second)) {
+            throw new IllegalStateException("Dropout mask did not change after backward");
+        }
+
+        int kept = 0;
+        for (double value : first) {
+            if (value != 0.0) {
+                kept++;
+                if (Math.abs(value - 1.0 / (1.0 - rate)) > 1e-12) {
+                    throw new IllegalStateException("Kept dropout values must be scaled by 1 / (1 - rate)");
+                }
+            }
+        }
+        double keepRate = (double) kept / size;
+        Utils.consoleLog("Dropout keep rate (expected " + (1.0 - rate) + "): ", 33);
+        System.out.println(keepRate);
+        if (Math.abs(keepRate - (1.0 - rate)) > 0.03) {
+            throw new IllegalStateException("Dropout keep rate differs from 1 - rate");
+        }
+    }
+
+    /**
+     * @brief Evaluates sum(weights * outputs) of a layer, a scalar loss whose output gradient is weights
+     * @param layer Layer to evaluate
+     * @param x Layer input
+     * @param weights Weight of each output
+     * @return Weighted sum of the outputs
+     */
+    private static double weightedOutput(Layer layer, double[] x, double[] weights) {
+        List<Double> outputs = layer.activateLayer(Utils.toList(x));
+        double sum = 0.0;
+        for (int i = 0; i < weights.length; i++) {
+            sum += weights[i] * outputs.get(i);
+        }
+        return sum;
+    }
+
+    /**
+     * @brief Compares analytic gradients of weightedOutput with central finite differences
+     * @param layer Layer to evaluate
+     * @param x Layer input
+     * @param weights Weight of each output
+     * @param parameter Array the gradients refer to, perturbed in place and restored; may be x itself
+     * @param analytic Analytic gradient of each entry of parameter
+     * @return Largest difference, relative to the gradient where it exceeds 1
+     */
+    private static double maxGradientError(Layer layer, double[] x, double[] weights, double[] parameter, double[] analytic) {
+        double h = 1e-6;
+        double max = 0.0;
+        for (int k = 0; k < parameter.length; k++) {
+            double saved = parameter[k];
+            parameter[k] = saved + h;
+            double plus = weightedOutput(layer, x, weights);
+            parameter[k] = saved - h;
+            double minus = weightedOutput(layer, x, weights);
+            parameter[k] = saved;
+            double numeric = (plus - minus) / (2.0 * h);
+            max = Math.max(max, Math.abs(numeric - analytic[k]) / Math.max(1.0, Math.abs(analytic[k])));
+        }
+        return max;
+    }
+
+    /**
+     * @brief Draws an array of standard normal values
+     * @param rand Random source
+     * @param length Number of values
+     * @return Random values
+     */
+    private static double[] randomArray(Random rand, int length) {
+        double[] values = new double[length];
+        for (int i = 0; i < length; i++) {
+            values[i] = rand.nextGaussian();
+        }
+        return values;
+    }
+
+    /**
+     * @brief Builds a dense sigmoid network whose weights and biases come from a fixed seed
+     * @param sizes Width of the input and of every layer
+     * @param seed Random seed
+     * @return Network with reproducible parameters
+     */
+    private static NeuralNetworkImpl seededNetwork(List<Integer> sizes, long seed) {
+        Random rand = new Random(seed);
+        List<Layer> layers = new ArrayList<>();
+        for (int i = 1; i < sizes.size(); i++) {
+            List<Neuron> neurons = new ArrayList<>();
+            for (int n = 0; n < sizes.get(i); n++) {
+                List<Double> weights = new ArrayList<>();
+                for (int c = 0; c < sizes.get(i - 1); c++) {
+                    weights.add(rand.nextGaussian());
+                }
+                neurons.add(new Neuron(weights, rand.nextGaussian()));
+            }
+            layers.add(new Layer(neurons));
+        }
+        return NeuralNetworkImpl.fromLayers(layers);
+    }
+
+    /**
+     * @brief Finds the largest difference between corresponding weights and biases of two dense networks
+     * @param a First network
+     * @param b Second network with the same shape
+     * @return Largest absolute parameter difference
+     */
+    private static double maxParameterDifference(NeuralNetworkImpl a, NeuralNetworkImpl b) {
+        double max = 0.0;
+        for (int i = 0; i < a.getLayers().size(); i++) {
+            Layer la = a.getLayers().get(i);
+            Layer lb = b.getLayers().get(i);
+            double[] wa = la.getWeightMatrix();
+            double[] wb = lb.getWeightMatrix();
+            for (int k = 0; k < wa.length; k++) {
+                max = Math.max(max, Math.abs(wa[k] - wb[k]));
+            }
+            double[] ba = la.getBiasVector();
+            double[] bb = lb.getBiasVector();
+            for (int k = 0; k < ba.length; k++) {
+                max = Math.max(max, Math.abs(ba[k] - bb[k]));
+            }
+        }
+        return max;
     }
 }
 
@@ -263,5 +6572,15 @@ public class neuralNetwork {
     public static void main(String[] args) {
         Utils.consoleLog("Starting Neural Network...", 33);
         NeuralNetworkTest.testCustomNetwork(4, 3, 2, Arrays.asList(0.1, 0.4, 0.2, 0.3));
+        NeuralNetworkTest.testQuantizedNetwork(Arrays.asList(0.1, 0.4, 0.2, 0.3));
+        NeuralNetworkTest.testReducedPrecision(Arrays.asList(0.1, 0.4, 0.2, 0.3));
+        NeuralNetworkTest.testTiedAutoencoder(Arrays.asList(0.1, 0.4, 0.2, 0.3), 2);
+        NeuralNetworkTest.testCheckpointedGradients(Arrays.asList(0.1, 0.4, 0.2, 0.3));
+        NeuralNetworkTest.testGradientAccumulation(Arrays.asList(0.1, 0.4, 0.2, 0.3));
+        NeuralNetworkTest.testLayerNormGradients();
+        NeuralNetworkTest.testConvolutionGradients();
+        NeuralNetworkTest.testConvolutionForward();
+        NeuralNetworkTest.testTiledAttention();
+        NeuralNetworkTest.testDropoutMask();
     }
 }
\ No newline at end of file